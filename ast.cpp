@@ -1,9 +1,12 @@
 #include "stdafx.h"
 #include <cstdio>
 #include <cstring>
+#include <set>
+#include <algorithm>
 
 #include "ast.h"
 #include "log.h"
+#include "profile.h"
 
 using namespace llvm;
 
@@ -12,6 +15,14 @@ namespace core {
         printf("literal(%s; %d %d %d)", value.c_str(), is_real, is_int, is_bool);
     }
     
+    void ast_array_literal::dump() {
+        printf("array(");
+        for(auto& elem : elements) {
+            elem->dump(); printf(", ");
+        }
+        printf(")");
+    }
+    
     ast_identifier::ast_identifier(const char* pszName) {
         strncpy(name, pszName, 128);
     }
@@ -26,6 +37,13 @@ namespace core {
         printf(" : %s)", type->get_type_name().c_str());
     }
     
+    void ast_const::dump() {
+        printf("const(");
+        decl.dump(); printf(" = ");
+        value->dump();
+        printf(")");
+    }
+    
     void ast_prototype::dump() {
         printf("prototype(");
         name->dump();
@@ -56,6 +74,12 @@ namespace core {
         printf(")");
     }
     
+    void ast_unary_op::dump() {
+        printf("un_op(%c;", op);
+        if(operand) operand->dump();
+        printf(")");
+    }
+    
     void ast_function_call::dump() {
         printf("fncall(");
         name->dump(); printf("; ");
@@ -67,13 +91,89 @@ namespace core {
     
     void ast_branching::dump() {
         printf("branch(");
+        if(hint != branch_hint::none) {
+            printf(hint == branch_hint::likely ? "likely " : "unlikely ");
+        }
         condition->dump(); printf(" -> "); line->dump(); printf(")");
     }
     
+    void ast_while::dump() {
+        printf("while(");
+        condition->dump(); printf(" {\n");
+        for(auto& line : body) {
+            line->dump(); printf(";\n");
+        }
+        printf("})");
+    }
+    
+    void ast_for::dump() {
+        printf("for(");
+        var.dump(); printf("; ");
+        from->dump(); printf("; ");
+        to->dump(); printf(" {\n");
+        for(auto& line : body) {
+            line->dump(); printf(";\n");
+        }
+        printf("})");
+    }
+    
     void ast_type::dump() {
         printf("type(%s)", pType->get_type_name().c_str());
     }
     
+    // Traversal
+    
+    void ast_array_literal::for_each_child(const child_fn& fn) {
+        for(auto& elem : elements) {
+            fn(elem);
+        }
+    }
+    
+    void ast_const::for_each_child(const child_fn& fn) {
+        fn(value);
+    }
+    
+    void ast_function::for_each_child(const child_fn& fn) {
+        for(auto& line : lines) {
+            fn(line);
+        }
+    }
+    
+    void ast_binary_op::for_each_child(const child_fn& fn) {
+        fn(lhs);
+        fn(rhs);
+    }
+    
+    void ast_unary_op::for_each_child(const child_fn& fn) {
+        fn(operand);
+    }
+    
+    void ast_function_call::for_each_child(const child_fn& fn) {
+        for(auto& arg : args) {
+            fn(arg);
+        }
+    }
+    
+    void ast_branching::for_each_child(const child_fn& fn) {
+        fn(condition);
+        fn(line);
+    }
+    
+    void ast_while::for_each_child(const child_fn& fn) {
+        fn(condition);
+        for(auto& line : body) {
+            fn(line);
+        }
+    }
+    
+    void ast_for::for_each_child(const child_fn& fn) {
+        fn(from);
+        fn(to);
+        for(auto& line : body) {
+            fn(line);
+        }
+    }
+    
     // Codegen
     
     static llvm::AllocaInst* create_entry_block_alloca(llvm_ctx& ctx, llvm::Function* pFunc, const llvm::StringRef name, llvm::Type* pType) {
@@ -81,17 +181,23 @@ namespace core {
         return TmpB.CreateAlloca(pType, 0, name);
     }
     
-    static llvm::AllocaInst* create_entry_block_alloca(llvm_ctx& ctx, llvm::Function* pFunc, const llvm::StringRef name, llvm::Type* pType, llvm::Value* len) {
-        IRBuilder<> TmpB(&pFunc->getEntryBlock(), pFunc->getEntryBlock().begin());
-        return TmpB.CreateAlloca(pType, len, name);
-    }
-    
+    // Type of a scalar type name
     static llvm::Type* str_to_type(llvm_ctx& ctx, const std::string& s) {
         llvm::Type* ret = nullptr;
         if(s == "real") {
             return Type::getDoubleTy(ctx.ctx);
+        } else if(s == "int") {
+            return Type::getInt64Ty(ctx.ctx);
         } else if(s == "bool") {
             return Type::getInt1Ty(ctx.ctx);
+        } else if(s == "f32") {
+            return Type::getFloatTy(ctx.ctx);
+        } else if(s == "i32") {
+            return Type::getInt32Ty(ctx.ctx);
+        } else if(s == "i16") {
+            return Type::getInt16Ty(ctx.ctx);
+        } else if(s == "i8") {
+            return Type::getInt8Ty(ctx.ctx);
         }
         return ret;
     }
@@ -108,18 +214,33 @@ namespace core {
         if(is_real) {
             return ConstantFP::get(ctx.ctx, APFloat(std::stod(value.c_str())));
         } else if(is_int) {
-            return ConstantInt::get(ctx.ctx, APInt(64, std::stoi(value.c_str())));
+            return ConstantInt::get(ctx.ctx, APInt(64, std::stoll(value.c_str()), true));
         } else if(is_bool) {
             return ConstantInt::get(ctx.ctx, APInt(1, value == "true"));
+        } else if(is_string) {
+            return ctx.builder.CreateGlobalStringPtr(value, "strtmp");
         }
         log_err(this, "Literal has unknown type\n");
         return nullptr;
     }
     
+    // Storage of a local, or null if there's none by that name; arrays in
+    // the arena are reached through the address in their alloca
+    static llvm::Value* get_local(llvm_ctx& ctx, const std::string& name) {
+        auto it = ctx.locals.find(name);
+        if(it == ctx.locals.end()) {
+            return nullptr;
+        }
+        if(it->second->getType()->getPointerElementType()->isPointerTy()) {
+            return ctx.builder.CreateLoad(it->second, name);
+        }
+        return it->second;
+    }
+    
     llvm::Value* ast_identifier::generate_ir(llvm_ctx& ctx) {
         auto sname = std::string(name);
         if(ctx.locals.count(sname)) {
-            auto ret = ctx.locals[sname];
+            auto ret = get_local(ctx, sname);
             return ctx.builder.CreateLoad(ret, name);
         }
         if(ctx.globals.count(sname)) {
@@ -130,14 +251,315 @@ namespace core {
         return nullptr;
     }
     
-    llvm::Value* ast_binary_op::generate_ir(llvm_ctx& ctx) {
-        llvm::Value* ret = nullptr;
-        auto R = rhs->generate_ir(ctx);
+    static bool is_bool(const llvm::Value* pValue) {
+        return pValue->getType()->isIntegerTy(1);
+    }
+    
+    // Slices are the arrays with a length only known at runtime: { T*, i64 }
+    static bool is_slice(const llvm::Type* pType) {
+        auto pTyStruct = dyn_cast<StructType>(pType);
+        return pTyStruct && pTyStruct->isLiteral() && pTyStruct->getNumElements() == 2 &&
+            pTyStruct->getElementType(0)->isPointerTy() && pTyStruct->getElementType(1)->isIntegerTy(64);
+    }
+    
+    static bool is_map_builtin(const char* pszName) {
+        return strcmp(pszName, "mapreals") == 0 || strcmp(pszName, "mapints") == 0 ||
+            strcmp(pszName, "storereals") == 0 || strcmp(pszName, "storeints") == 0;
+    }
+    
+    // Loop depth of the arena memory or the mapping a view refers to, as
+    // far as it's known here
+    static int view_depth(llvm_ctx& ctx, ast_expression* expr) {
+        if(auto pCall = dynamic_cast<ast_function_call*>(expr)) {
+            return is_map_builtin(pCall->name->name) ? ctx.loop_depth : 0;
+        }
+        if(auto pId = dynamic_cast<ast_identifier*>(expr)) {
+            auto it = ctx.local_depths.find(pId->name);
+            return it != ctx.local_depths.end() ? it->second : 0;
+        }
+        return 0;
+    }
+    
+    // Source locations are only tracked when there's debug info
+    static void set_debug_loc(llvm_ctx& ctx, int line, int col) {
+        if(ctx.di_scope) {
+            ctx.builder.SetCurrentDebugLocation(llvm::DebugLoc::get(line, col, ctx.di_scope));
+        }
+    }
+    
+    // Literals are reals and ints; used where a narrower type is expected,
+    // they take that type, if an integer fits in it. Anything else is
+    // returned as it is
+    static llvm::Value* convert_literal(llvm_ctx& ctx, ast_expression* expr, llvm::Value* V, llvm::Type* pType) {
+        if(V->getType() == pType) {
+            return V;
+        }
+        if(auto pInt = dyn_cast<ConstantInt>(V)) {
+            if(!pType->isIntegerTy() || pType->isIntegerTy(1) || is_bool(pInt)) {
+                return V;
+            }
+            if(!pInt->getValue().isSignedIntN(pType->getIntegerBitWidth())) {
+                log_err(expr, "Integer %lld doesn't fit in '%s'\n", (long long)pInt->getSExtValue(), type_to_str(pType).c_str());
+                return nullptr;
+            }
+            return ConstantInt::get(pType, pInt->getSExtValue(), true);
+        }
+        if(auto pReal = dyn_cast<ConstantFP>(V)) {
+            if(!pType->isFloatingPointTy()) {
+                return V;
+            }
+            APFloat value = pReal->getValueAPF();
+            bool lost;
+            value.convert(pType->getFltSemantics(), APFloat::rmNearestTiesToEven, &lost);
+            return ConstantFP::get(ctx.ctx, value);
+        }
+        return V;
+    }
+    
+    // Only the legacy int to real mix is converted implicitly; narrower
+    // integers and f32 need real(x), f32(x) and the like
+    static llvm::Value* implicit_int_to_real(llvm_ctx& ctx, ast_expression* expr, llvm::Value* V, llvm::Type* pTyReal) {
+        if(!V->getType()->isIntegerTy(64) || !pTyReal->isDoubleTy()) {
+            auto sv = type_to_str(V->getType());
+            auto sr = type_to_str(pTyReal);
+            log_err(expr, "Can't implicitly convert '%s' to '%s'; use %s(x)\n", sv.c_str(), sr.c_str(), pTyReal->isDoubleTy() ? "real" : "f32");
+            return nullptr;
+        }
+        log_warn(expr, "Implicitly converting integer to real!\n");
+        return ctx.builder.CreateSIToFP(V, pTyReal);
+    }
+    
+    // Converts a value to the type of the variable it's stored in; only
+    // literals and integers are converted, the latter to reals
+    static llvm::Value* convert_for_store(llvm_ctx& ctx, ast_expression* expr, llvm::Value* V, llvm::Type* pTyVar) {
+        V = convert_literal(ctx, expr, V, pTyVar);
+        if(!V) {
+            return nullptr;
+        }
+        auto pTyValue = V->getType();
+        if(pTyVar == pTyValue) {
+            return V;
+        }
+        if(pTyVar->isFloatingPointTy() && pTyValue->isIntegerTy()) {
+            return implicit_int_to_real(ctx, expr, V, pTyVar);
+        }
+        auto stvar = type_to_str(pTyVar);
+        auto stval = type_to_str(pTyValue);
+        log_err(expr, "Assigning to '%s' from incompatible type '%s\n", stvar.c_str(), stval.c_str());
+        return nullptr;
+    }
+    
+    // With no array to go into, the elements are of the type of the first
+    // one and there are as many as given; a constant array if every element
+    // is known at compile time
+    static llvm::Value* generate_array_literal(llvm_ctx& ctx, ast_array_literal* lit, llvm::Type* pTyElem = nullptr, uint64_t count = 0) {
+        std::vector<llvm::Value*> values;
+        bool all_constant = true;
+        for(auto& elem : lit->elements) {
+            auto V = elem->generate_ir(ctx);
+            if(!V) {
+                return nullptr;
+            }
+            if(!pTyElem) {
+                pTyElem = V->getType();
+                count = lit->elements.size();
+            }
+            V = convert_for_store(ctx, elem.get(), V, pTyElem);
+            if(!V) {
+                return nullptr;
+            }
+            all_constant = all_constant && isa<Constant>(V);
+            values.push_back(V);
+        }
+        
+        if(!pTyElem) {
+            log_err(lit, "Type of an empty array literal isn't known\n");
+            return nullptr;
+        }
+        if(values.size() > count) {
+            log_err(lit, "Array literal has %d elements, but the array only has %d\n", (int)values.size(), (int)count);
+            return nullptr;
+        }
+        
+        auto pTyArray = ArrayType::get(pTyElem, count);
+        if(all_constant) {
+            std::vector<Constant*> elems;
+            for(auto V : values) {
+                elems.push_back(cast<Constant>(V));
+            }
+            elems.resize(count, Constant::getNullValue(pTyElem));
+            return ConstantArray::get(pTyArray, elems);
+        }
+        llvm::Value* ret = Constant::getNullValue(pTyArray);
+        for(unsigned i = 0; i < values.size(); i++) {
+            ret = ctx.builder.CreateInsertValue(ret, values[i], i);
+        }
+        return ret;
+    }
+    
+    // Arrays known at compile time are copied with one memcpy from a
+    // constant global, instead of stored element by element; returns the
+    // array stored, or null if it isn't known
+    static llvm::Constant* store_constant_array(llvm_ctx& ctx, llvm::Value* pVar, llvm::Value* R) {
+        auto pTyArray = R->getType();
+        auto pTyElem = pTyArray->getArrayElementType();
+        auto& dl = ctx.module.getDataLayout();
+        unsigned align = dl.getTypeAllocSize(pTyElem);
+        
+        auto pLoad = dyn_cast<LoadInst>(R);
+        if(pLoad) {
+            // A module level constant
+            auto pSrc = dyn_cast<GlobalVariable>(pLoad->getPointerOperand());
+            if(!pSrc || !pSrc->isConstant()) {
+                return nullptr;
+            }
+            ctx.builder.CreateMemCpy(pVar, align, pSrc, align, dl.getTypeAllocSize(pTyArray));
+            pLoad->eraseFromParent();
+            return pSrc->getInitializer();
+        }
+        
+        auto pInit = dyn_cast<Constant>(R);
+        if(!pInit) {
+            return nullptr;
+        }
+        
+        // The zeros a literal ends in are set rather than copied, so a big
+        // array with a few values given doesn't take up as much in .rodata
+        unsigned count = pTyArray->getArrayNumElements();
+        unsigned n_copied = count;
+        while(n_copied > 0 && pInit->getAggregateElement(n_copied - 1)->isNullValue()) {
+            n_copied--;
+        }
+        if(n_copied < count) {
+            auto pTail = ctx.builder.CreateConstInBoundsGEP2_32(pTyArray, pVar, 0, n_copied);
+            ctx.builder.CreateMemSet(pTail, ctx.builder.getInt8(0), (count - n_copied) * dl.getTypeAllocSize(pTyElem), align);
+        }
+        if(n_copied > 0) {
+            std::vector<Constant*> elems;
+            for(unsigned i = 0; i < n_copied; i++) {
+                elems.push_back(pInit->getAggregateElement(i));
+            }
+            auto pTyCopied = ArrayType::get(pTyElem, n_copied);
+            auto pSrc = new GlobalVariable(ctx.module, pTyCopied, true, GlobalValue::PrivateLinkage, ConstantArray::get(pTyCopied, elems), "arrinit");
+            pSrc->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+            pSrc->setAlignment(align);
+            ctx.builder.CreateMemCpy(pVar, align, pSrc, align, dl.getTypeAllocSize(pTyCopied));
+        }
+        return pInit;
+    }
+    
+    llvm::Value* ast_array_literal::generate_ir(llvm_ctx& ctx) {
+        return generate_array_literal(ctx, this);
+    }
+    
+    // Generates '&&' and '||'; the right-hand side is only evaluated when it
+    // decides the result
+    static llvm::Value* generate_short_circuit(llvm_ctx& ctx, ast_binary_op* expr) {
+        bool is_and = expr->op == '&';
+        
+        auto L = expr->lhs->generate_ir(ctx);
+        if(!L) {
+            log_err(expr->lhs.get(), "Failure in left-hand side expression\n");
+            return nullptr;
+        }
+        if(!is_bool(L)) {
+            log_err(expr->lhs.get(), "Operand of a logical operator must be a boolean!\n");
+            return nullptr;
+        }
+        
+        Function* pFunc = ctx.builder.GetInsertBlock()->getParent();
+        BasicBlock* pBBLHS = ctx.builder.GetInsertBlock();
+        BasicBlock* pBBRHS = BasicBlock::Create(ctx.ctx, is_and ? "land.rhs" : "lor.rhs", pFunc);
+        BasicBlock* pBBEnd = BasicBlock::Create(ctx.ctx, is_and ? "land.end" : "lor.end", pFunc);
+        
+        if(is_and) {
+            create_cond_br(ctx, L, pBBRHS, pBBEnd);
+        } else {
+            create_cond_br(ctx, L, pBBEnd, pBBRHS);
+        }
+        
+        ctx.builder.SetInsertPoint(pBBRHS);
+        auto R = expr->rhs->generate_ir(ctx);
         if(!R) {
-            log_err(rhs.get(), "Failure in right-hand side expression\n");
+            log_err(expr->rhs.get(), "Failure in right-hand side expression\n");
+            return nullptr;
+        }
+        if(!is_bool(R)) {
+            log_err(expr->rhs.get(), "Operand of a logical operator must be a boolean!\n");
+            return nullptr;
+        }
+        ctx.builder.CreateBr(pBBEnd);
+        pBBRHS = ctx.builder.GetInsertBlock();
+        
+        ctx.builder.SetInsertPoint(pBBEnd);
+        PHINode* pPhi = ctx.builder.CreatePHI(Type::getInt1Ty(ctx.ctx), 2, "logtmp");
+        pPhi->addIncoming(ConstantInt::get(ctx.ctx, APInt(1, !is_and)), pBBLHS);
+        pPhi->addIncoming(R, pBBRHS);
+        return pPhi;
+    }
+    
+    // Arithmetic and comparisons on integers; booleans can only be compared
+    static llvm::Value* generate_int_op(llvm_ctx& ctx, ast_binary_op* expr, llvm::Value* L, llvm::Value* R) {
+        llvm::Value* ret = nullptr;
+        
+        if(is_bool(L) && expr->op != '?' && expr->op != '!') {
+            log_err(expr, "Operator %c can't be applied to booleans!\n", expr->op);
             return ret;
         }
         
+        switch(expr->op) {
+            case '+':
+            ret = ctx.builder.CreateAdd(L, R, "addtmp");
+            break;
+            case '-':
+            ret = ctx.builder.CreateSub(L, R, "subtmp");
+            break;
+            case '*':
+            ret = ctx.builder.CreateMul(L, R, "multmp");
+            break;
+            case '/':
+            ret = ctx.builder.CreateSDiv(L, R, "divtmp");
+            break;
+            case '?':
+            ret = ctx.builder.CreateICmpEQ(L, R, "cmptmp");
+            break;
+            case '!':
+            ret = ctx.builder.CreateICmpNE(L, R, "cmptmp");
+            break;
+            case '<':
+            ret = ctx.builder.CreateICmpSLT(L, R, "cmptmp");
+            break;
+            case '>':
+            ret = ctx.builder.CreateICmpSGT(L, R, "cmptmp");
+            break;
+            default:
+            log_err(expr, "Unknown operator %c\n", expr->op);
+            break;
+        }
+        
+        set_debug_loc(ctx, expr->line, expr->col);
+        
+        return ret;
+    }
+    
+    llvm::Value* ast_binary_op::generate_ir(llvm_ctx& ctx) {
+        llvm::Value* ret = nullptr;
+        
+        if(op == '&' || op == '|') {
+            return generate_short_circuit(ctx, this);
+        }
+        
+        // Array literals are generated once the array they go into is known
+        auto pArrayLit = op == '=' ? dynamic_cast<ast_array_literal*>(rhs.get()) : nullptr;
+        llvm::Value* R = nullptr;
+        if(!pArrayLit) {
+            R = rhs->generate_ir(ctx);
+            if(!R) {
+                log_err(rhs.get(), "Failure in right-hand side expression\n");
+                return ret;
+            }
+        }
+        
         if(op == '=') {
             // lhs must be an lvalue
             auto pLHS = dynamic_cast<ast_identifier*>(lhs.get());
@@ -152,28 +574,50 @@ namespace core {
                     return ret;
                 }
             }
-            auto pVar = ctx.locals[pLHS->name];
+            auto pVar = get_local(ctx, pLHS->name);
             if(!pVar) {
-                log_err(lhs.get(), "Unknown variable referenced\n");
+                if(ctx.globals.count(pLHS->name)) {
+                    log_err(lhs.get(), "Can't assign to constant '%s'\n", pLHS->name);
+                } else {
+                    log_err(lhs.get(), "Unknown variable referenced\n");
+                }
                 return ret;
             }
             
-            auto pTyVar = pVar->getType()->getElementType();
-            auto pTyRValue = R->getType();
+            auto pTyVar = pVar->getType()->getPointerElementType();
+            if(pArrayLit) {
+                if(!pTyVar->isArrayTy()) {
+                    log_err(rhs.get(), "Array literal assigned to '%s', which isn't an array\n", pLHS->name);
+                    return ret;
+                }
+                R = generate_array_literal(ctx, pArrayLit, pTyVar->getArrayElementType(), pTyVar->getArrayNumElements());
+                if(!R) {
+                    return ret;
+                }
+            }
             
-            if(pTyVar != pTyRValue) {
-                if(pTyVar->isFloatingPointTy() && pTyRValue->isIntegerTy()) {
-                    // Convert rvalue to double
-                    log_warn(rhs.get(), "Implicitly converting integer to real!\n");
-                    R = ctx.builder.CreateSIToFP(R, pTyVar);
-                } else {
-                    auto stvar = type_to_str(pTyVar);
-                    auto stval = type_to_str(pTyRValue);
-                    log_err(this, "Assigning to '%s' from incompatible type '%s\n", stvar.c_str(), stval.c_str());
+            if(pTyVar->isArrayTy() && R->getType() == pTyVar) {
+                // The load of a constant it's copied from is gone after
+                auto pStored = store_constant_array(ctx, pVar, R);
+                if(pStored) {
+                    ret = pStored;
                     return ret;
                 }
             }
             
+            R = convert_for_store(ctx, rhs.get(), R, pTyVar);
+            if(!R) {
+                return ret;
+            }
+            
+            // A view made in a loop body would outlive the iteration
+            auto it = ctx.local_depths.find(pLHS->name);
+            auto var_depth = it != ctx.local_depths.end() ? it->second : 0;
+            if(is_slice(pTyVar) && view_depth(ctx, rhs.get()) > var_depth) {
+                log_err(rhs.get(), "Array assigned to '%s' is released at the end of the loop iteration; declare '%s' in the loop body\n", pLHS->name, pLHS->name);
+                return ret;
+            }
+            
             ctx.builder.CreateStore(R, pVar);
             ret = R;
             return ret;
@@ -184,18 +628,30 @@ namespace core {
                 return ret;
             }
             
+            // Wider values aren't narrowed and narrower ones aren't widened,
+            // but a literal takes the type of the other operand
+            R = convert_literal(ctx, rhs.get(), R, L->getType());
+            L = R ? convert_literal(ctx, lhs.get(), L, R->getType()) : nullptr;
+            if(!L || !R) {
+                return ret;
+            }
+            
             auto pTyL = L->getType();
             auto pTyR = R->getType();
             
             if(pTyL != pTyR) {
                 if(pTyL->isFloatingPointTy() && pTyR->isIntegerTy()) {
                     // Convert R to double
-                    log_warn(rhs.get(), "Implicitly converting integer to real!\n");
-                    R = ctx.builder.CreateSIToFP(R, pTyL);
+                    R = implicit_int_to_real(ctx, rhs.get(), R, pTyL);
+                    if(!R) {
+                        return ret;
+                    }
                 } else if(pTyR->isFloatingPointTy() && pTyL->isIntegerTy()) {
                     // Convert L to double
-                    log_warn(lhs.get(), "Implicitly converting integer to real!\n");
-                    L = ctx.builder.CreateSIToFP(L, pTyR);
+                    L = implicit_int_to_real(ctx, lhs.get(), L, pTyR);
+                    if(!L) {
+                        return ret;
+                    }
                 } else {
                     auto sl = type_to_str(L->getType());
                     auto sr = type_to_str(R->getType());
@@ -204,6 +660,10 @@ namespace core {
                 }
             }
             
+            if(L->getType()->isIntegerTy()) {
+                return generate_int_op(ctx, this, L, R);
+            }
+            
             switch(op) {
                 case '+':
                 ret = ctx.builder.CreateFAdd(L, R, "addtmp");
@@ -235,32 +695,449 @@ namespace core {
             }
         }
         
-        ctx.builder.SetCurrentDebugLocation(llvm::DebugLoc::get(line, col, ctx.di_scope));
+        set_debug_loc(ctx, line, col);
         
         return ret;
     }
     
+    llvm::Value* ast_unary_op::generate_ir(llvm_ctx& ctx) {
+        auto V = operand->generate_ir(ctx);
+        if(!V) {
+            log_err(operand.get(), "Failure in operand of unary operation\n");
+            return nullptr;
+        }
+        
+        switch(op) {
+            case '!':
+            if(!is_bool(V)) {
+                log_err(operand.get(), "Operand of '!' must be a boolean!\n");
+                return nullptr;
+            }
+            return ctx.builder.CreateNot(V, "nottmp");
+        }
+        
+        log_err(this, "Unknown unary operator %c\n", op);
+        return nullptr;
+    }
+    
+    // Arena
+    
+    // Fixed size arrays larger than this are allocated from the arena
+    // instead of the stack
+    static const uint64_t arena_array_threshold = 64 * 1024;
+    
+    static llvm::CallInst* call_arena_mark(IRBuilder<>& B, llvm_ctx& ctx, const llvm::Twine& name) {
+        auto pTyMark = FunctionType::get(Type::getInt8PtrTy(ctx.ctx), false);
+        return B.CreateCall(ctx.module.getOrInsertFunction("corert_arena_mark", pTyMark), {}, name);
+    }
+    
+    static llvm::CallInst* call_arena_release(IRBuilder<>& B, llvm_ctx& ctx, llvm::Value* pMark) {
+        auto pTyRelease = FunctionType::get(Type::getVoidTy(ctx.ctx), { Type::getInt8PtrTy(ctx.ctx) }, false);
+        return B.CreateCall(ctx.module.getOrInsertFunction("corert_arena_release", pTyRelease), { pMark });
+    }
+    
+    // Allocates count elements from the arena; the first allocation of a
+    // function marks the arena at the entry of the function
+    static void ensure_arena_mark(llvm_ctx& ctx) {
+        if(!ctx.arena_mark) {
+            auto pFunc = ctx.builder.GetInsertBlock()->getParent();
+            IRBuilder<> TmpB(&pFunc->getEntryBlock(), pFunc->getEntryBlock().begin());
+            TmpB.SetCurrentDebugLocation(ctx.builder.getCurrentDebugLocation());
+            ctx.arena_mark = call_arena_mark(TmpB, ctx, "arenamark");
+        }
+        ctx.arena_allocs++;
+    }
+    
+    static llvm::Value* generate_arena_alloc(llvm_ctx& ctx, llvm::Type* pTyElem, llvm::Value* pVCount, const llvm::Twine& name) {
+        ensure_arena_mark(ctx);
+        
+        auto pTyInt64 = Type::getInt64Ty(ctx.ctx);
+        auto pAlloc = ctx.module.getFunction("corert_arena_alloc");
+        if(!pAlloc) {
+            auto pTyAlloc = FunctionType::get(Type::getInt8PtrTy(ctx.ctx), { pTyInt64, pTyInt64 }, false);
+            pAlloc = Function::Create(pTyAlloc, Function::ExternalLinkage, "corert_arena_alloc", &ctx.module);
+            pAlloc->addAttribute(AttributeList::ReturnIndex, Attribute::NoAlias);
+        }
+        auto pMem = ctx.builder.CreateCall(pAlloc, { pVCount, ConstantExpr::getSizeOf(pTyElem) }, "arenatmp");
+        return ctx.builder.CreateBitCast(pMem, pTyElem->getPointerTo(), name);
+    }
+    
+    // Releases the arena memory of a function before each of its returns
+    static void release_arena(llvm_ctx& ctx, llvm::Function* pFunc) {
+        if(!ctx.arena_mark) {
+            return;
+        }
+        for(auto& BB : *pFunc) {
+            if(auto pRet = dyn_cast_or_null<ReturnInst>(BB.getTerminator())) {
+                IRBuilder<> TmpB(pRet);
+                call_arena_release(TmpB, ctx, ctx.arena_mark);
+            }
+        }
+        ctx.arena_mark = nullptr;
+    }
+    
+    // Arena memory allocated by the body of a loop is released at the end
+    // of every iteration
+    static void release_iteration(llvm_ctx& ctx, llvm::BasicBlock* pBBBody, size_t n_allocs) {
+        if(ctx.arena_allocs == n_allocs) {
+            return;
+        }
+        IRBuilder<> TmpB(pBBBody, pBBBody->getFirstInsertionPt());
+        TmpB.SetCurrentDebugLocation(ctx.builder.getCurrentDebugLocation());
+        auto pMark = call_arena_mark(TmpB, ctx, "itermark");
+        call_arena_release(ctx.builder, ctx, pMark);
+    }
+    
+    static llvm::Value* make_slice(llvm_ctx& ctx, llvm::Type* pTySlice, llvm::Value* pElems, llvm::Value* pLen) {
+        llvm::Value* ret = UndefValue::get(pTySlice);
+        ret = ctx.builder.CreateInsertValue(ret, pElems, 0);
+        return ctx.builder.CreateInsertValue(ret, pLen, 1, "slicetmp");
+    }
+    
+    // Arrays sized at runtime live in the arena; the local holds the slice.
+    // Without a length, the local is an empty view, e.g. of a mapped file
+    static llvm::Value* generate_runtime_array(llvm_ctx& ctx, ast_declaration* decl, slice_type* pSlice) {
+        auto pszName = decl->identifier->name;
+        auto pTySlice = pSlice->get_llvm_type(ctx);
+        auto pFunc = ctx.builder.GetInsertBlock()->getParent();
+        if(pSlice->length_name.empty()) {
+            auto pVar = create_entry_block_alloca(ctx, pFunc, pszName, pTySlice);
+            ctx.builder.CreateStore(Constant::getNullValue(pTySlice), pVar);
+            return pVar;
+        }
+        if(!ctx.locals.count(pSlice->length_name)) {
+            log_err(decl, "Unknown variable '%s' in the length of array '%s'\n", pSlice->length_name.c_str(), pszName);
+            return nullptr;
+        }
+        auto pVLen = ctx.builder.CreateLoad(ctx.locals[pSlice->length_name], pSlice->length_name);
+        if(!pVLen->getType()->isIntegerTy(64)) {
+            log_err(decl, "Length of array '%s' must be an int!\n", pszName);
+            return nullptr;
+        }
+        
+        auto pElems = generate_arena_alloc(ctx, pSlice->contained->get_llvm_type(ctx), pVLen, pszName);
+        auto pVar = create_entry_block_alloca(ctx, pFunc, pszName, pTySlice);
+        ctx.builder.CreateStore(make_slice(ctx, pTySlice, pElems, pVLen), pVar);
+        return pVar;
+    }
+    
     llvm::Value* ast_declaration::generate_ir(llvm_ctx& ctx) {
-        llvm::AllocaInst* ret = nullptr;
+        llvm::Value* ret = nullptr;
         auto pFunc = ctx.builder.GetInsertBlock()->getParent();
-        if(type->count() > 1) {
-            auto len = ConstantInt::get(ctx.ctx, APInt(64, type->count()));
-            ret = create_entry_block_alloca(ctx, pFunc, identifier->name, type->get_llvm_type(ctx), len);
+        auto pType = type->get_llvm_type(ctx);
+        if(auto pSlice = dynamic_cast<slice_type*>(type.get())) {
+            ret = generate_runtime_array(ctx, this, pSlice);
+        } else if(pType->isArrayTy() && ctx.module.getDataLayout().getTypeAllocSize(pType) > arena_array_threshold) {
+            // Large arrays would overflow the stack
+            auto pTyArray = cast<ArrayType>(pType);
+            auto pCount = ConstantInt::get(Type::getInt64Ty(ctx.ctx), pTyArray->getNumElements());
+            auto pElems = generate_arena_alloc(ctx, pTyArray->getElementType(), pCount, "");
+            ret = create_entry_block_alloca(ctx, pFunc, identifier->name, pType->getPointerTo());
+            ctx.builder.CreateStore(ctx.builder.CreateBitCast(pElems, pType->getPointerTo()), ret);
         } else {
-            ret = create_entry_block_alloca(ctx, pFunc, identifier->name, type->get_llvm_type(ctx));
+            ret = create_entry_block_alloca(ctx, pFunc, identifier->name, pType);
+        }
+        if(ret) {
+            ctx.locals[identifier->name] = ret;
+            ctx.local_depths[identifier->name] = ctx.loop_depth;
         }
-        ctx.locals.emplace(identifier->name, ret);
         return ret;
     }
     
+    // Literals, or array literals of them, after folding
+    static bool is_constant_value(ast_expression* expr) {
+        if(auto pLit = dynamic_cast<ast_literal*>(expr)) {
+            return !pLit->is_string;
+        }
+        auto pArrayLit = dynamic_cast<ast_array_literal*>(expr);
+        if(!pArrayLit) {
+            return false;
+        }
+        for(auto& elem : pArrayLit->elements) {
+            auto pLit = dynamic_cast<ast_literal*>(elem.get());
+            if(!pLit || pLit->is_string) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    llvm::Value* ast_const::generate_ir(llvm_ctx& ctx) {
+        auto pszName = decl.identifier->name;
+        if(ctx.globals.count(pszName)) {
+            log_err(this, "Redefinition of constant '%s'\n", pszName);
+            return nullptr;
+        }
+        if(dynamic_cast<slice_type*>(decl.type.get())) {
+            log_err(this, "Constant array '%s' needs a length\n", pszName);
+            return nullptr;
+        }
+        // Checked before generating, as there's no function to generate
+        // anything else into
+        if(!is_constant_value(value.get())) {
+            log_err(value.get(), "Value of constant '%s' isn't known at compile time\n", pszName);
+            return nullptr;
+        }
+        
+        auto pType = decl.type->get_llvm_type(ctx);
+        llvm::Value* V = nullptr;
+        if(auto pArrayLit = dynamic_cast<ast_array_literal*>(value.get())) {
+            if(!pType->isArrayTy()) {
+                log_err(value.get(), "Array literal assigned to '%s', which isn't an array\n", pszName);
+                return nullptr;
+            }
+            V = generate_array_literal(ctx, pArrayLit, pType->getArrayElementType(), pType->getArrayNumElements());
+        } else {
+            V = value->generate_ir(ctx);
+            V = V ? convert_for_store(ctx, value.get(), V, pType) : nullptr;
+        }
+        if(!V) {
+            return nullptr;
+        }
+        
+        // Every source including it gets its own copy
+        auto pGlobal = new GlobalVariable(ctx.module, pType, true, GlobalValue::InternalLinkage, cast<Constant>(V), pszName);
+        pGlobal->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+        ctx.globals[pszName] = pGlobal;
+        return pGlobal;
+    }
+    
+    // Elements and length of an array or a slice
+    struct array_ref {
+        llvm::Value* pElems = nullptr;
+        llvm::Value* pLen = nullptr;
+        llvm::Type* pTyElem = nullptr;
+        // Length if it's known at compile time, -1 otherwise
+        int64_t known_len = -1;
+        // A module level constant, which can't be stored to
+        bool is_const = false;
+    };
+    
+    // Array values that aren't in a local are spilled to the stack first
+    static bool generate_array_ref(llvm_ctx& ctx, ast_expression* expr, array_ref& ref) {
+        llvm::Value* pArray = nullptr;
+        auto pId = dynamic_cast<ast_identifier*>(expr);
+        auto pLocal = pId ? get_local(ctx, pId->name) : nullptr;
+        if(pLocal && pLocal->getType()->getPointerElementType()->isArrayTy()) {
+            pArray = pLocal;
+        } else if(pId && !ctx.locals.count(pId->name) && ctx.globals.count(pId->name) && ctx.globals[pId->name]->getValueType()->isArrayTy()) {
+            // Indexed in place, rather than loaded and spilled
+            pArray = ctx.globals[pId->name];
+            ref.is_const = true;
+        } else {
+            auto V = expr->generate_ir(ctx);
+            if(!V) {
+                return false;
+            }
+            if(is_slice(V->getType())) {
+                ref.pElems = ctx.builder.CreateExtractValue(V, 0, "elems");
+                ref.pLen = ctx.builder.CreateExtractValue(V, 1, "len");
+                ref.pTyElem = ref.pElems->getType()->getPointerElementType();
+                return true;
+            }
+            if(!V->getType()->isArrayTy()) {
+                log_err(expr, "Not an array!\n");
+                return false;
+            }
+            auto pFunc = ctx.builder.GetInsertBlock()->getParent();
+            pArray = create_entry_block_alloca(ctx, pFunc, "arrtmp", V->getType());
+            ctx.builder.CreateStore(V, pArray);
+        }
+        
+        auto pTyArray = cast<ArrayType>(pArray->getType()->getPointerElementType());
+        ref.pElems = ctx.builder.CreateConstInBoundsGEP2_32(pTyArray, pArray, 0, 0);
+        ref.known_len = pTyArray->getNumElements();
+        ref.pLen = ConstantInt::get(Type::getInt64Ty(ctx.ctx), ref.known_len);
+        ref.pTyElem = pTyArray->getElementType();
+        return true;
+    }
+    
+    // Memory mapped files
+    
+    // madvise hints of the mapping builtins, in the order the runtime
+    // numbers them
+    static const char* map_hints[] = { "normal", "sequential", "willneed", "random" };
+    
+    // mapreals(path[, hint]) and mapints(path[, hint]) return a view of a
+    // file of little-endian doubles or int64s; storereals(path, n[, hint])
+    // and storeints(path, n[, hint]) create a file of n elements and return
+    // a view that writes through to it. The mapping is released with the
+    // arena of the function that made it
+    static llvm::Value* generate_map_file(llvm_ctx& ctx, ast_function_call* call) {
+        auto pszName = call->name->name;
+        auto& args = call->args;
+        bool is_store = strncmp(pszName, "store", 5) == 0;
+        size_t n_args = is_store ? 2 : 1;
+        if(args.size() != n_args && args.size() != n_args + 1) {
+            if(is_store) {
+                log_err(call, "%s expects a file name, the number of elements and an optional hint\n", pszName);
+            } else {
+                log_err(call, "%s expects a file name and an optional hint\n", pszName);
+            }
+            return nullptr;
+        }
+        
+        int64_t hint = 0;
+        if(args.size() > n_args) {
+            auto pHint = dynamic_cast<ast_identifier*>(args[n_args].get());
+            auto it = pHint ? std::find_if(std::begin(map_hints), std::end(map_hints), [&](const char* h) { return strcmp(h, pHint->name) == 0; }) : std::end(map_hints);
+            if(it == std::end(map_hints)) {
+                log_err(args[n_args].get(), "Unknown mapping hint; expected normal, sequential, willneed or random\n");
+                return nullptr;
+            }
+            hint = it - std::begin(map_hints);
+        }
+        
+        auto pTyInt8Ptr = Type::getInt8PtrTy(ctx.ctx);
+        auto pPath = args[0]->generate_ir(ctx);
+        if(!pPath) {
+            return nullptr;
+        }
+        if(pPath->getType() != pTyInt8Ptr) {
+            log_err(args[0].get(), "File name must be a string!\n");
+            return nullptr;
+        }
+        
+        auto pTyInt64 = Type::getInt64Ty(ctx.ctx);
+        bool is_real = strstr(pszName, "reals") != nullptr;
+        auto pTyElem = is_real ? Type::getDoubleTy(ctx.ctx) : pTyInt64;
+        auto pTySlice = StructType::get(ctx.ctx, { pTyElem->getPointerTo(), pTyInt64 });
+        auto pVElemSize = ConstantExpr::getSizeOf(pTyElem);
+        auto pVHint = ConstantInt::get(pTyInt64, hint);
+        
+        // The runtime records the mapping in the arena
+        ensure_arena_mark(ctx);
+        
+        llvm::Value* pMem;
+        llvm::Value* pLen;
+        if(is_store) {
+            pLen = args[1]->generate_ir(ctx);
+            if(!pLen) {
+                return nullptr;
+            }
+            if(!pLen->getType()->isIntegerTy(64)) {
+                log_err(args[1].get(), "Number of elements must be an int!\n");
+                return nullptr;
+            }
+            auto pTyMap = FunctionType::get(pTyInt8Ptr, { pTyInt8Ptr, pTyInt64, pTyInt64, pTyInt64 }, false);
+            pMem = ctx.builder.CreateCall(ctx.module.getOrInsertFunction("corert_map_output", pTyMap), { pPath, pLen, pVElemSize, pVHint }, "maptmp");
+        } else {
+            auto pFunc = ctx.builder.GetInsertBlock()->getParent();
+            auto pLenVar = create_entry_block_alloca(ctx, pFunc, "maplen", pTyInt64);
+            auto pTyMap = FunctionType::get(pTyInt8Ptr, { pTyInt8Ptr, pTyInt64, pTyInt64, pTyInt64->getPointerTo() }, false);
+            pMem = ctx.builder.CreateCall(ctx.module.getOrInsertFunction("corert_map_file", pTyMap), { pPath, pVElemSize, pVHint, pLenVar }, "maptmp");
+            pLen = ctx.builder.CreateLoad(pLenVar, "maplen");
+        }
+        auto pElems = ctx.builder.CreateBitCast(pMem, pTyElem->getPointerTo());
+        return make_slice(ctx, pTySlice, pElems, pLen);
+    }
+    
+    // real(x), int(x), f32(x), i32(x), i16(x) and i8(x) convert between the
+    // numeric types; integers are sign extended or truncated, and reals are
+    // rounded toward zero when they're converted to integers
+    static llvm::Value* generate_conversion(llvm_ctx& ctx, ast_function_call* call, llvm::Type* pTyTo) {
+        auto pszName = call->name->name;
+        if(pTyTo->isIntegerTy(1)) {
+            log_err(call, "Values can't be converted to booleans; compare them instead\n");
+            return nullptr;
+        }
+        if(call->args.size() != 1) {
+            log_err(call, "%s expects the value to convert as its only argument\n", pszName);
+            return nullptr;
+        }
+        auto V = call->args[0]->generate_ir(ctx);
+        if(!V) {
+            return nullptr;
+        }
+        auto pTyFrom = V->getType();
+        if(is_bool(V) || (!pTyFrom->isIntegerTy() && !pTyFrom->isFloatingPointTy())) {
+            log_err(call->args[0].get(), "Can't convert a(n) %s to %s\n", type_to_str(pTyFrom).c_str(), pszName);
+            return nullptr;
+        }
+        auto op = CastInst::getCastOpcode(V, true, pTyTo, true);
+        return ctx.builder.CreateCast(op, V, pTyTo, "convtmp");
+    }
+    
+    // The boolean functions of the runtime, unless the program defines its own
+    static bool is_logic_builtin(llvm_ctx& ctx, const char* pszName) {
+        if(strcmp(pszName, "lnot") != 0 && strcmp(pszName, "land") != 0 && strcmp(pszName, "lor") != 0) {
+            return false;
+        }
+        auto pFunc = ctx.module.getFunction(pszName);
+        return !pFunc || pFunc->isDeclaration();
+    }
+    
+    struct math_intrinsic {
+        const char* pszName;
+        llvm::Intrinsic::ID id;
+        size_t n_args;
+    };
+    
+    static const math_intrinsic math_intrinsics[] = {
+        {"sin", Intrinsic::sin, 1},
+        {"cos", Intrinsic::cos, 1},
+        {"sqrt", Intrinsic::sqrt, 1},
+        {"exp", Intrinsic::exp, 1},
+        {"exp2", Intrinsic::exp2, 1},
+        {"log", Intrinsic::log, 1},
+        {"log2", Intrinsic::log2, 1},
+        {"log10", Intrinsic::log10, 1},
+        {"fabs", Intrinsic::fabs, 1},
+        {"floor", Intrinsic::floor, 1},
+        {"ceil", Intrinsic::ceil, 1},
+        {"pow", Intrinsic::pow, 2},
+        {"fmin", Intrinsic::minnum, 2},
+        {"fmax", Intrinsic::maxnum, 2},
+        {"fma", Intrinsic::fma, 3},
+    };
+    
+    // Calls to known libm functions are lowered to LLVM intrinsics, so they
+    // can be constant folded and vectorized
+    static llvm::Value* generate_math_intrinsic(llvm_ctx& ctx, llvm::Function* pFunc, llvm::ArrayRef<llvm::Value*> vargs) {
+        if(!pFunc->isDeclaration() || !pFunc->getReturnType()->isDoubleTy()) {
+            return nullptr;
+        }
+        for(auto pVArg : vargs) {
+            if(!pVArg->getType()->isDoubleTy()) {
+                return nullptr;
+            }
+        }
+        
+        auto name = pFunc->getName();
+        if(name == "fmod" && vargs.size() == 2) {
+            return ctx.builder.CreateFRem(vargs[0], vargs[1], "fremtmp");
+        }
+        for(auto& intr : math_intrinsics) {
+            if(name == intr.pszName && vargs.size() == intr.n_args) {
+                auto pIntr = Intrinsic::getDeclaration(&ctx.module, intr.id, { Type::getDoubleTy(ctx.ctx) });
+                return ctx.builder.CreateCall(pIntr, vargs, "calltmp");
+            }
+        }
+        return nullptr;
+    }
+    
     llvm::Value* ast_function_call::generate_ir(llvm_ctx& ctx) {
         llvm::Value* ret = nullptr;
         
         if(strcmp(name->name, "return") == 0) { // return is technically a function call
+            // The body of a parallel loop is a task of its own
+            if(ctx.in_parallel_task) {
+                log_err(this, "Can't return from a parallel loop\n");
+                return ret;
+            }
             // TODO: typecheck here
             auto n_args = args.size();
             if(n_args == 1) {
                 auto V = args[0]->generate_ir(ctx);
+                if(!V) {
+                    return ret;
+                }
+                // So a literal is returned as an f32 or an i8 too
+                auto pTyRet = ctx.builder.GetInsertBlock()->getParent()->getReturnType();
+                V = convert_literal(ctx, args[0].get(), V, pTyRet);
+                if(!V) {
+                    return ret;
+                }
                 ret = ctx.builder.CreateRet(V);
             } else if (n_args == 0) {
                 ret = ctx.builder.CreateRetVoid();
@@ -268,74 +1145,209 @@ namespace core {
                 log_err(this, "Aggregate return is not allowed!\n");
             }
             return ret;
-        } else if(strcmp(name->name, "idx") == 0) {
-            auto n_args = args.size();
-            if(n_args == 2) {
-                auto array = args[0]->generate_ir(ctx);
-                auto index = args[1]->generate_ir(ctx);
-                if(!array->getType()->isArrayTy()) {
-                    log_err(args[0].get(), "Not an array!\n");
-                } else if(!index->getType()->isIntegerTy()) {
-                    log_err(args[1].get(), "Not an integer!\n");
-                } else {
-                    auto pTyArray = (llvm::ArrayType*)array->getType();
-                    // If the index can be casted to an ast_literal then do a bounds check
-                    auto pIdxLiteral = dynamic_cast<ast_literal*>(args[1].get());
-                    if(pIdxLiteral) {
-                        if(!pIdxLiteral->is_int) {
-                            log_err(pIdxLiteral, "Index must be an integer!\n");
-                            return ret;
-                        }
-                        int i = std::stoi(pIdxLiteral->value);
-                        uint64_t n = pTyArray->getNumElements();
-                        if(i < 0 || (i > n && i != (uint64_t)-1)) {
-                            log_warn(pIdxLiteral, "Indexing out of bounds; array length is %u, index is %u\n", n, i);
-                        }
-                    }
-                    
-                    auto pTyElem = pTyArray->getElementType();
-                    auto array_ptr = ctx.builder.CreatePointerCast(array, array->getType()->getPointerTo());
-                    ret = ctx.builder.CreateGEP(array_ptr, index);
-                    ret = ctx.builder.CreateLoad(pTyElem, ret);
-                }
-            } else if(n_args == 3) {
-                auto array = args[0]->generate_ir(ctx);
-                auto index = args[1]->generate_ir(ctx);
-                auto value = args[2]->generate_ir(ctx);
-                if(!array->getType()->isArrayTy()) {
-                    log_err(args[0].get(), "Not an array!\n");
-                    return ret;
-                }
-                if(!index->getType()->isIntegerTy()) {
-                    log_err(args[1].get(), "Not an integer!\n");
+        } else if(strcmp(name->name, "idx") == 0) {
+            auto n_args = args.size();
+            if(n_args != 2 && n_args != 3) {
+                log_err(this, "Indexing operation requires two arguments: the array indexed and the index\n");
+                return ret;
+            }
+            
+            array_ref array;
+            if(!generate_array_ref(ctx, args[0].get(), array)) {
+                return ret;
+            }
+            auto index = args[1]->generate_ir(ctx);
+            if(!index) {
+                return ret;
+            }
+            if(!index->getType()->isIntegerTy()) {
+                log_err(args[1].get(), "Not an integer!\n");
+                return ret;
+            }
+            
+            // If the index can be casted to an ast_literal then do a bounds check
+            auto pIdxLiteral = dynamic_cast<ast_literal*>(args[1].get());
+            if(pIdxLiteral && array.known_len >= 0) {
+                if(!pIdxLiteral->is_int) {
+                    log_err(pIdxLiteral, "Index must be an integer!\n");
+                    return ret;
+                }
+                long long i = std::stoll(pIdxLiteral->value);
+                uint64_t n = array.known_len;
+                if(i < 0 || (uint64_t)i >= n) {
+                    // NOTE: we could issue a warning only then let it crash tbh
+                    log_warn(pIdxLiteral, "Indexing out of bounds; array length is %llu, index is %lld\n", (unsigned long long)n, i);
+                }
+            }
+            
+            if(n_args == 3 && array.is_const) {
+                log_err(args[0].get(), "Can't store to a constant array\n");
+                return ret;
+            }
+            
+            auto pElem = ctx.builder.CreateGEP(array.pElems, index, "idxtmp");
+            if(n_args == 2) {
+                ret = ctx.builder.CreateLoad(pElem, "elemtmp");
+            } else {
+                auto value = args[2]->generate_ir(ctx);
+                value = value ? convert_literal(ctx, args[2].get(), value, array.pTyElem) : nullptr;
+                if(!value) {
+                    return ret;
+                }
+                auto pTyElem = array.pTyElem;
+                auto pTyVal = value->getType();
+                if(pTyElem != pTyVal) {
+                    log_err(args[2].get(), "Value needs to have the same type that's contained in the array!\n\tPassed: %s Contained: %s\n", type_to_str(pTyVal).c_str(), type_to_str(pTyElem).c_str());
+                    return ret;
+                }
+                ret = ctx.builder.CreateStore(value, pElem);
+            }
+            return ret;
+        } else if(strcmp(name->name, "printarr") == 0) {
+            // Prints every element of an array with a single call to the runtime
+            if(args.size() != 1) {
+                log_err(this, "printarr expects the array to print as its only argument\n");
+                return ret;
+            }
+            array_ref array;
+            if(!generate_array_ref(ctx, args[0].get(), array)) {
+                return ret;
+            }
+            
+            auto pTyElem = array.pTyElem;
+            const char* pszPrint = nullptr;
+            if(pTyElem->isDoubleTy()) {
+                pszPrint = "corert_print_reals";
+            } else if(pTyElem->isIntegerTy(64)) {
+                pszPrint = "corert_print_ints";
+            } else if(pTyElem->isIntegerTy(1)) {
+                pszPrint = "corert_print_bools";
+            } else {
+                log_err(args[0].get(), "Can't print an array of %s\n", type_to_str(pTyElem).c_str());
+                return ret;
+            }
+            
+            auto pTyInt64 = Type::getInt64Ty(ctx.ctx);
+            auto pTyPrint = FunctionType::get(Type::getVoidTy(ctx.ctx), { pTyElem->getPointerTo(), pTyInt64 }, false);
+            ctx.builder.CreateCall(ctx.module.getOrInsertFunction(pszPrint, pTyPrint), { array.pElems, array.pLen });
+            ret = ConstantInt::getTrue(ctx.ctx);
+            return ret;
+        } else if(strcmp(name->name, "len") == 0) {
+            if(args.size() != 1) {
+                log_err(this, "len expects an array as its only argument\n");
+                return ret;
+            }
+            array_ref array;
+            if(!generate_array_ref(ctx, args[0].get(), array)) {
+                return ret;
+            }
+            ret = array.pLen;
+            return ret;
+        } else if(is_map_builtin(name->name)) {
+            ret = generate_map_file(ctx, this);
+            return ret;
+        } else if(auto pTyTo = str_to_type(ctx, name->name)) {
+            ret = generate_conversion(ctx, this, pTyTo);
+            return ret;
+        } else if(strcmp(name->name, "pmap") == 0) {
+            // pmap(f, src, dst) is a parallel for over src doing idx(dst, i, f(idx(src, i)))
+            if(args.size() != 3) {
+                log_err(this, "pmap expects a function, the source and the destination array\n");
+                return ret;
+            }
+            auto pFn = dynamic_cast<ast_identifier*>(args[0].get());
+            auto pSrc = dynamic_cast<ast_identifier*>(args[1].get());
+            auto pDst = dynamic_cast<ast_identifier*>(args[2].get());
+            if(!pFn || !pSrc || !pDst) {
+                log_err(this, "Arguments of pmap must be a function name and two arrays\n");
+                return ret;
+            }
+            array_ref src, dst;
+            if(!generate_array_ref(ctx, pSrc, src) || !generate_array_ref(ctx, pDst, dst)) {
+                return ret;
+            }
+            if(dst.is_const) {
+                log_err(pDst, "Can't store to a constant array\n");
+                return ret;
+            }
+            if(src.known_len >= 0 && dst.known_len >= 0 && dst.known_len < src.known_len) {
+                log_err(pDst, "Destination of pmap is shorter than the source\n");
+                return ret;
+            }
+            
+            const char* pszIter = "pmap.i";
+            auto make_id = [this](const char* pszName) {
+                auto ret = std::make_unique<ast_identifier>(pszName);
+                ret->line = line; ret->col = col;
+                return ret;
+            };
+            auto make_call = [&](const char* pszName) {
+                auto ret = std::make_unique<ast_function_call>();
+                ret->name = make_id(pszName);
+                ret->line = line; ret->col = col;
+                return ret;
+            };
+            auto make_int = [this](uint64_t v) {
+                auto ret = std::make_unique<ast_literal>(std::to_string(v));
+                ret->is_int = true;
+                ret->line = line; ret->col = col;
+                return ret;
+            };
+            auto pLen = make_call("len");
+            pLen->args.push_back(make_id(pSrc->name));
+            
+            auto pLoad = make_call("idx");
+            pLoad->args.push_back(make_id(pSrc->name));
+            pLoad->args.push_back(make_id(pszIter));
+            auto pApply = make_call(pFn->name);
+            pApply->args.push_back(std::move(pLoad));
+            auto pStore = make_call("idx");
+            pStore->args.push_back(make_id(pDst->name));
+            pStore->args.push_back(make_id(pszIter));
+            pStore->args.push_back(std::move(pApply));
+            
+            ast_for loop;
+            loop.line = line; loop.col = col;
+            loop.parallel = true;
+            loop.var.identifier = make_id(pszIter);
+            loop.var.type = std::make_shared<type_int>();
+            loop.from = make_int(0);
+            loop.to = std::move(pLen);
+            loop.body.push_back(std::move(pStore));
+            if(!loop.generate_ir(ctx)) {
+                return ret;
+            }
+            ret = ConstantInt::getTrue(ctx.ctx);
+            return ret;
+        } else if(is_logic_builtin(ctx, name->name)) {
+            // lnot, land and lor from the runtime are lowered inline
+            // Like any other call, both arguments of land and lor are evaluated
+            bool is_not = strcmp(name->name, "lnot") == 0;
+            size_t n_args = is_not ? 1 : 2;
+            if(args.size() != n_args) {
+                log_err(this, "Function '%s' expects %d argument(s), but %d was passed!\n", name->name, (int)n_args, (int)args.size());
+                return ret;
+            }
+            
+            std::vector<llvm::Value*> vargs;
+            for(auto& arg : args) {
+                auto pVArg = arg->generate_ir(ctx);
+                if(!pVArg) {
                     return ret;
                 }
-                auto pTyArray = (llvm::ArrayType*)array->getType();
-                // If the index can be casted to an ast_literal then do a bounds check
-                auto pIdxLiteral = dynamic_cast<ast_literal*>(args[1].get());
-                if(pIdxLiteral) {
-                    if(!pIdxLiteral->is_int) {
-                        log_err(pIdxLiteral, "Index must be an integer!\n");
-                        return ret;
-                    }
-                    uint64_t i = std::stoi(pIdxLiteral->value);
-                    uint64_t n = pTyArray->getNumElements();
-                    if(i < 0 || (i > n && i != (uint64_t)-1)) {
-                        // NOTE: we could issue a warning only then let it crash tbh
-                        log_warn(pIdxLiteral, "Indexing out of bounds; array length is %u, index is %u\n", n, i);
-                    }
-                }
-                auto pTyElem = ((llvm::ArrayType*)array->getType())->getElementType();
-                auto pTyVal = value->getType();
-                if(pTyElem != pTyVal) {
-                    log_err(args[2].get(), "Value needs to have the same type that's contained in the array!\n\tPassed: %s Contained: %s\n", type_to_str(pTyVal).c_str(), type_to_str(pTyElem).c_str());
+                if(!is_bool(pVArg)) {
+                    log_err(arg.get(), "Argument of '%s' must be a boolean!\n", name->name);
                     return ret;
                 }
-                auto array_ptr = ctx.builder.CreatePointerCast(array, array->getType()->getPointerTo());
-                ret = ctx.builder.CreateGEP(array_ptr, index);
-                ret = ctx.builder.CreateStore(value, ret);
+                vargs.push_back(pVArg);
+            }
+            
+            if(is_not) {
+                ret = ctx.builder.CreateNot(vargs[0], "nottmp");
+            } else if(strcmp(name->name, "land") == 0) {
+                ret = ctx.builder.CreateAnd(vargs[0], vargs[1], "andtmp");
             } else {
-                log_err(this, "Indexing operation requires two arguments: the array indexed and the index\n");
+                ret = ctx.builder.CreateOr(vargs[0], vargs[1], "ortmp");
             }
             return ret;
         } else {
@@ -358,15 +1370,43 @@ namespace core {
             std::vector<llvm::Value*> vargs;
             int iArg = 0;
             for(auto& arg : pFunc->args()) {
-                auto pVArg = args[iArg]->generate_ir(ctx);
                 auto pTyArg = arg.getType();
+                llvm::Value* pVArg = nullptr;
+                if(is_slice(pTyArg)) {
+                    // Arrays are passed to parameters of unknown length by reference
+                    array_ref array;
+                    if(!generate_array_ref(ctx, args[iArg].get(), array)) {
+                        return ret;
+                    }
+                    auto pTyElem = pTyArg->getStructElementType(0)->getPointerElementType();
+                    if(array.pTyElem != pTyElem) {
+                        auto sf = type_to_str(pTyElem);
+                        auto sp = type_to_str(array.pTyElem);
+                        log_err(this, "Type mismatch in function call: argument %i of %s expect an array of type %s, but was passed a(n) array of %s\n", iArg, name->name, sf.c_str(), sp.c_str());
+                        return ret;
+                    }
+                    if(array.is_const) {
+                        // The callee may store through the slice
+                        log_err(args[iArg].get(), "Can't pass a constant array to argument %i of %s\n", iArg, name->name);
+                        return ret;
+                    }
+                    pVArg = make_slice(ctx, pTyArg, array.pElems, array.pLen);
+                } else {
+                    pVArg = args[iArg]->generate_ir(ctx);
+                    pVArg = pVArg ? convert_literal(ctx, args[iArg].get(), pVArg, pTyArg) : nullptr;
+                }
+                if(!pVArg) {
+                    return ret;
+                }
                 auto pTyVArg = pVArg->getType();
                 
                 if(pTyVArg != pTyArg) {
                     if(pTyArg->isFloatingPointTy() && pTyVArg->isIntegerTy()) {
                         // Convert R to double
-                        log_warn(args[iArg].get(), "Implicitly converting integer to real!\n");
-                        pVArg = ctx.builder.CreateSIToFP(pVArg, pTyArg);
+                        pVArg = implicit_int_to_real(ctx, args[iArg].get(), pVArg, pTyArg);
+                        if(!pVArg) {
+                            return ret;
+                        }
                     } else if(pTyArg->isArrayTy() && pTyVArg->isArrayTy()) {
                         auto pTyArgArr = static_cast<llvm::ArrayType*>(pTyArg);
                         auto pTyVArgArr = static_cast<llvm::ArrayType*>(pTyVArg);
@@ -398,19 +1438,220 @@ namespace core {
                 iArg++;
             }
             
-            ret = ctx.builder.CreateCall(pFunc, vargs, "calltmp");
+            ret = generate_math_intrinsic(ctx, pFunc, vargs);
+            if(!ret) {
+                ret = ctx.builder.CreateCall(pFunc, vargs, "calltmp");
+            }
             
             return ret;
         }
     }
     
+    // Attributes of a declaration are added to those of the earlier ones
+    static bool set_function_attributes(llvm_ctx& ctx, ast_prototype* proto, Function* pFunc) {
+        auto attributes = proto->attributes;
+        if(pFunc->hasFnAttribute(Attribute::AlwaysInline)) {
+            attributes |= fn_inline;
+        }
+        if(pFunc->hasFnAttribute(Attribute::NoInline)) {
+            attributes |= fn_noinline;
+        }
+        if(pFunc->hasFnAttribute(Attribute::Cold)) {
+            attributes |= fn_cold;
+        }
+        attributes |= ctx.func_modifiers[pFunc];
+        if((attributes & fn_inline) && (attributes & fn_noinline)) {
+            log_err(proto, "Function '%s' is declared both inline and noinline\n", pFunc->getName().str().c_str());
+            return false;
+        }
+        if((attributes & fn_hot) && (attributes & fn_cold)) {
+            log_err(proto, "Function '%s' is declared both hot and cold\n", pFunc->getName().str().c_str());
+            return false;
+        }
+        
+        if(attributes & fn_inline) {
+            // Also at -O0 and -O1, where only these are inlined
+            pFunc->addFnAttr(Attribute::AlwaysInline);
+        }
+        if(attributes & fn_noinline) {
+            pFunc->addFnAttr(Attribute::NoInline);
+        }
+        if(attributes & fn_cold) {
+            // Also makes the branches leading to calls to it unlikely
+            pFunc->addFnAttr(Attribute::Cold);
+        }
+        ctx.func_modifiers[pFunc] = attributes & (fn_hot | fn_flatten);
+        return true;
+    }
+    
+    // Hot and cold functions go to .text.hot and .text.unlikely, which the
+    // linker places together; a flattened function's calls are inlined
+    static void set_definition_attributes(llvm_ctx& ctx, Function* pFunc) {
+        auto modifiers = ctx.func_modifiers[pFunc];
+        if(modifiers & fn_hot) {
+            pFunc->setSectionPrefix(".hot");
+        } else if(pFunc->hasFnAttribute(Attribute::Cold)) {
+            pFunc->setSectionPrefix(".unlikely");
+        }
+        
+        if(!(modifiers & fn_flatten)) {
+            return;
+        }
+        for(auto& bb : *pFunc) {
+            for(auto& inst : bb) {
+                auto pCall = dyn_cast<CallInst>(&inst);
+                auto pCallee = pCall ? pCall->getCalledFunction() : nullptr;
+                if(pCallee && !pCallee->isIntrinsic() && !pCallee->hasFnAttribute(Attribute::NoInline)) {
+                    pCall->addAttribute(AttributeList::FunctionIndex, Attribute::AlwaysInline);
+                }
+            }
+        }
+    }
+    
+    // The flags go on the real arithmetic the builder creates, and on the
+    // function as attributes, for the backend
+    static void set_fast_math(llvm_ctx& ctx, Function* pFunc, FastMathFlags fmf) {
+        ctx.builder.setFastMathFlags(fmf);
+        if(fmf.isFast()) {
+            pFunc->addFnAttr("unsafe-fp-math", "true");
+        }
+        if(fmf.noNaNs()) {
+            pFunc->addFnAttr("no-nans-fp-math", "true");
+        }
+        if(fmf.noInfs()) {
+            pFunc->addFnAttr("no-infs-fp-math", "true");
+        }
+        if(fmf.noSignedZeros()) {
+            pFunc->addFnAttr("no-signed-zeros-fp-math", "true");
+        }
+    }
+    
+    // Memoization
+    // A memo function looks its arguments up in its cache in the runtime
+    // before running its body, and stores the result before every return:
+    //   bool corert_memo_lookup(memo, i64* keys, i64* result)
+    //   void corert_memo_store(memo, i64* keys, i64 result)
+    // The memo is { name, next memo, number of arguments, hits, misses,
+    // table, lock }. Arguments and results are kept as their bits in i64s
+    struct memo_state {
+        llvm::Value* pMemo = nullptr;
+        llvm::Value* pKeys = nullptr;
+        // Return of the cached result, which isn't stored again
+        llvm::ReturnInst* pHitRet = nullptr;
+    };
+    
+    // Only the results of pure functions of numbers and booleans are cached
+    static bool check_memo(ast_function* func, llvm::Function* pFunc) {
+        auto proto = func->prototype.get();
+        auto name = pFunc->getName().str();
+        if(!proto->is_pure) {
+            log_err(proto, "Only pure functions can be memoized, '%s' isn't pure\n", name.c_str());
+            return false;
+        }
+        for(auto& arg : pFunc->args()) {
+            auto pType = arg.getType();
+            if(!pType->isIntegerTy() && !pType->isFloatingPointTy()) {
+                log_err(proto, "Argument '%s' of memoized function '%s' isn't a number or a boolean\n", proto->args[arg.getArgNo()].identifier->name, name.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    static llvm::Value* to_memo_bits(IRBuilder<>& B, llvm::Value* V) {
+        auto pType = V->getType();
+        if(pType->isFloatingPointTy()) {
+            V = B.CreateBitCast(V, B.getIntNTy(pType->getScalarSizeInBits()));
+        }
+        return B.CreateZExt(V, B.getInt64Ty());
+    }
+    
+    static llvm::Value* from_memo_bits(IRBuilder<>& B, llvm::Value* V, llvm::Type* pType) {
+        if(pType->isFloatingPointTy()) {
+            return B.CreateBitCast(B.CreateTrunc(V, B.getIntNTy(pType->getScalarSizeInBits())), pType);
+        }
+        return B.CreateTrunc(V, pType);
+    }
+    
+    // Returns the cached result if there's one; the body goes after
+    static void generate_memo_lookup(llvm_ctx& ctx, llvm::Function* pFunc, memo_state& memo) {
+        auto pTyInt64 = Type::getInt64Ty(ctx.ctx);
+        auto pTyInt8Ptr = Type::getInt8PtrTy(ctx.ctx);
+        auto name = pFunc->getName().str();
+        auto pName = ConstantDataArray::getString(ctx.ctx, name);
+        auto pGVName = new GlobalVariable(ctx.module, pName->getType(), true, GlobalValue::PrivateLinkage, pName, "corec.memo.name");
+        
+        auto pTyMemo = StructType::get(ctx.ctx, { pTyInt8Ptr, pTyInt8Ptr, pTyInt64, pTyInt64, pTyInt64, pTyInt8Ptr, pTyInt64 });
+        auto pInit = ConstantStruct::get(pTyMemo, {
+            ConstantExpr::getBitCast(pGVName, pTyInt8Ptr),
+            ConstantPointerNull::get(pTyInt8Ptr),
+            ConstantInt::get(pTyInt64, pFunc->arg_size()),
+            ConstantInt::get(pTyInt64, 0),
+            ConstantInt::get(pTyInt64, 0),
+            ConstantPointerNull::get(pTyInt8Ptr),
+            ConstantInt::get(pTyInt64, 0),
+        });
+        auto pGVMemo = new GlobalVariable(ctx.module, pTyMemo, false, GlobalValue::InternalLinkage, pInit, "corec.memo." + name);
+        memo.pMemo = ConstantExpr::getBitCast(pGVMemo, pTyInt8Ptr);
+        
+        auto pTyKeys = ArrayType::get(pTyInt64, std::max<size_t>(pFunc->arg_size(), 1));
+        auto pKeys = create_entry_block_alloca(ctx, pFunc, "memokeys", pTyKeys);
+        for(auto& arg : pFunc->args()) {
+            auto pSlot = ctx.builder.CreateConstInBoundsGEP2_32(pTyKeys, pKeys, 0, arg.getArgNo());
+            ctx.builder.CreateStore(to_memo_bits(ctx.builder, &arg), pSlot);
+        }
+        memo.pKeys = ctx.builder.CreateConstInBoundsGEP2_32(pTyKeys, pKeys, 0, 0);
+        auto pResult = create_entry_block_alloca(ctx, pFunc, "memoresult", pTyInt64);
+        
+        auto pTyLookup = FunctionType::get(Type::getInt1Ty(ctx.ctx), { pTyInt8Ptr, pTyInt64->getPointerTo(), pTyInt64->getPointerTo() }, false);
+        auto pFound = ctx.builder.CreateCall(ctx.module.getOrInsertFunction("corert_memo_lookup", pTyLookup), { memo.pMemo, memo.pKeys, pResult }, "memofound");
+        
+        BasicBlock* pBBHit = BasicBlock::Create(ctx.ctx, "memo.hit", pFunc);
+        BasicBlock* pBBMiss = BasicBlock::Create(ctx.ctx, "memo.miss", pFunc);
+        ctx.builder.CreateCondBr(pFound, pBBHit, pBBMiss);
+        
+        ctx.builder.SetInsertPoint(pBBHit);
+        auto pCached = ctx.builder.CreateLoad(pResult, "memocached");
+        memo.pHitRet = ctx.builder.CreateRet(from_memo_bits(ctx.builder, pCached, pFunc->getReturnType()));
+        
+        ctx.builder.SetInsertPoint(pBBMiss);
+    }
+    
+    static void generate_memo_store(llvm_ctx& ctx, llvm::Function* pFunc, memo_state& memo) {
+        auto pTyInt64 = Type::getInt64Ty(ctx.ctx);
+        auto pTyStore = FunctionType::get(Type::getVoidTy(ctx.ctx), { Type::getInt8PtrTy(ctx.ctx), pTyInt64->getPointerTo(), pTyInt64 }, false);
+        auto pStore = ctx.module.getOrInsertFunction("corert_memo_store", pTyStore);
+        for(auto& BB : *pFunc) {
+            auto pRet = dyn_cast_or_null<ReturnInst>(BB.getTerminator());
+            if(pRet && pRet != memo.pHitRet) {
+                IRBuilder<> TmpB(pRet);
+                TmpB.CreateCall(pStore, { memo.pMemo, memo.pKeys, to_memo_bits(TmpB, pRet->getReturnValue()) });
+            }
+        }
+    }
+    
+    // How an integer narrower than a register is extended across calls
+    static Attribute::AttrKind extension_attribute(llvm::Type* pType) {
+        if(pType->isIntegerTy(1)) {
+            return Attribute::ZExt;
+        }
+        if(pType->isIntegerTy(8) || pType->isIntegerTy(16)) {
+            return Attribute::SExt;
+        }
+        return Attribute::None;
+    }
+    
     llvm::Value* ast_prototype::generate_ir(llvm_ctx& ctx) {
         FunctionType* pFuncTy;
         Function* pFunc;
         std::vector<llvm::Type*> type_signature;
         llvm::SmallVector<Metadata*, 8> di_type_signature;
+        // Line tables don't need the types
+        bool di_types = ctx.debug_info == debug_info_level::full;
         
-        di_type_signature.push_back(ctx.di_types[type->name]);
+        if(di_types) {
+            di_type_signature.push_back(ctx.di_types[type->name]);
+        }
         
         for(auto& arg : args) {
             auto pType = arg.type;
@@ -419,6 +1660,9 @@ namespace core {
                 return nullptr;
             }
             type_signature.push_back(pType->get_llvm_type(ctx));
+            if(!di_types) {
+                continue;
+            }
             if(ctx.di_types.count(arg.type->get_type_name())) {
                 di_type_signature.push_back(ctx.di_types[arg.type->get_type_name()]);
             } else {
@@ -426,10 +1670,8 @@ namespace core {
             }
         }
         
-        if(strcmp(type->name, "bool") == 0) {
-            pFuncTy = FunctionType::get(Type::getInt1Ty(ctx.ctx), type_signature, false);
-        } else if(strcmp(type->name, "real") == 0) {
-            pFuncTy = FunctionType::get(Type::getDoubleTy(ctx.ctx), type_signature, false);
+        if(auto pTyRet = str_to_type(ctx, type->name)) {
+            pFuncTy = FunctionType::get(pTyRet, type_signature, false);
         } else {
             log_err(this, "Unknown type '%s' in function return type\n", type->name);
             return nullptr;
@@ -447,19 +1689,38 @@ namespace core {
             return nullptr;
         }
         
+        // Declared again, as by a module and the text it was made from both
+        pFunc = ctx.module.getFunction(id->name);
+        if(pFunc && pFunc->getFunctionType() == pFuncTy) {
+            return set_function_attributes(ctx, this, pFunc) ? pFunc : nullptr;
+        }
+        
         pFunc = Function::Create(pFuncTy, Function::ExternalLinkage, id->name, &ctx.module);
         
         ctx.func_is_pure.emplace(pFunc, is_pure);
+        if(!set_function_attributes(ctx, this, pFunc)) {
+            return nullptr;
+        }
+        
+        // Booleans are passed like C's _Bool, i8 and i16 like signed char
+        // and short
+        if(auto kind = extension_attribute(pFuncTy->getReturnType())) {
+            pFunc->addAttribute(AttributeList::ReturnIndex, kind);
+        }
         
         int i = 0;
         for(auto& arg : pFunc->args()) {
             arg.setName(args[i].identifier->name);
+            if(auto kind = extension_attribute(arg.getType())) {
+                arg.addAttr(kind);
+            }
             i++;
         }
         
-        llvm::DISubroutineType* pTySub = ctx.dbuilder.createSubroutineType(ctx.dbuilder.getOrCreateTypeArray(di_type_signature));
-        
-        ctx.di_func_sigs[pFunc] = pTySub;
+        if(ctx.compile_unit) {
+            llvm::DISubroutineType* pTySub = ctx.dbuilder.createSubroutineType(ctx.dbuilder.getOrCreateTypeArray(di_type_signature));
+            ctx.di_func_sigs[pFunc] = pTySub;
+        }
         
         return pFunc;
     }
@@ -484,35 +1745,68 @@ namespace core {
             return nullptr;
         }
         
+        // Declared before, maybe with other modifiers
+        if(!set_function_attributes(ctx, prototype.get(), pFunc)) {
+            return nullptr;
+        }
+        bool is_memo = prototype->attributes & fn_memo;
+        if(is_memo && !check_memo(this, pFunc)) {
+            return nullptr;
+        }
+        
         // DI
-        DIFile* pUnit = ctx.dbuilder.createFile(ctx.compile_unit->getFilename(), ctx.compile_unit->getDirectory());
-        DIScope* pScope = pUnit;
-        DISubprogram *SP = ctx.dbuilder.createFunction(pScope, pszFuncName, llvm::StringRef(), pUnit, prototype->line + 1, ctx.di_func_sigs[pFunc], false, true, prototype->line + 1, llvm::DINode::FlagPrototyped, false);
-        pFunc->setSubprogram(SP);
+        DIFile* pUnit = nullptr;
+        DISubprogram* SP = nullptr;
+        if(ctx.compile_unit) {
+            pUnit = ctx.dbuilder.createFile(ctx.compile_unit->getFilename(), ctx.compile_unit->getDirectory());
+            DIScope* pScope = pUnit;
+            SP = ctx.dbuilder.createFunction(pScope, pszFuncName, llvm::StringRef(), pUnit, prototype->line + 1, ctx.di_func_sigs[pFunc], false, true, prototype->line + 1, llvm::DINode::FlagPrototyped, false);
+            pFunc->setSubprogram(SP);
+        }
         ctx.di_scope = SP;
         // DI
         
         BasicBlock* pBB = BasicBlock::Create(ctx.ctx, "entry", pFunc);
         ctx.builder.SetInsertPoint(pBB);
+        // Don't let the argument spills inherit the previous function's location
+        ctx.builder.SetCurrentDebugLocation(llvm::DebugLoc());
+        set_debug_loc(ctx, line, 0);
         
         ctx.locals.clear();
+        ctx.local_depths.clear();
         
         int iArg = 0;
         for(auto& arg : pFunc->args()) {
-            auto stackvar = create_entry_block_alloca(ctx, pFunc, arg.getName(), arg.getType());
+            // Value names may be discarded, so names come from the prototype
+            auto pszArgName = prototype->args[iArg].identifier->name;
+            auto stackvar = create_entry_block_alloca(ctx, pFunc, pszArgName, arg.getType());
             ctx.builder.CreateStore(&arg, stackvar);
-            ctx.locals.emplace(arg.getName(), stackvar);
+            ctx.locals.emplace(pszArgName, stackvar);
             
-            //auto type_name = prototype->args[iArg].type;
             auto type_name = prototype->args[iArg].type->get_type_name();
+            iArg++;
             
-            DILocalVariable *D = ctx.dbuilder.createParameterVariable(SP, arg.getName(), ++iArg, pUnit, line, ctx.di_types[type_name], true);
-            ctx.dbuilder.insertDeclare(stackvar, D, ctx.dbuilder.createExpression(), llvm::DebugLoc::get(line, 0, SP), ctx.builder.GetInsertBlock());
+            if(ctx.debug_info == debug_info_level::full) {
+                auto pDIType = ctx.di_types.count(type_name) ? ctx.di_types[type_name] : ctx.di_types["_unknown"];
+                DILocalVariable *D = ctx.dbuilder.createParameterVariable(SP, pszArgName, iArg, pUnit, line, pDIType, true);
+                ctx.dbuilder.insertDeclare(stackvar, D, ctx.dbuilder.createExpression(), llvm::DebugLoc::get(line, 0, SP), ctx.builder.GetInsertBlock());
+            }
         }
         
-        ctx.builder.SetCurrentDebugLocation(llvm::DebugLoc::get(line, col, pUnit));
+        set_debug_loc(ctx, line, col);
         
         ctx.current_function_pure = prototype->is_pure;
+        ctx.arena_mark = nullptr;
+        auto fmf = ctx.fast_math;
+        if(prototype->attributes & fn_fastmath) {
+            fmf.setFast();
+        }
+        set_fast_math(ctx, pFunc, fmf);
+        profile_function_begin(ctx, pFunc);
+        memo_state memo;
+        if(is_memo) {
+            generate_memo_lookup(ctx, pFunc, memo);
+        }
         
         bool succ = true;
         for(auto& line : lines) {
@@ -523,6 +1817,12 @@ namespace core {
         ctx.current_function_pure = false;
         
         if(succ) {
+            if(is_memo) {
+                generate_memo_store(ctx, pFunc, memo);
+            }
+            release_arena(ctx, pFunc);
+            profile_function_end(ctx, pFunc);
+            set_definition_attributes(ctx, pFunc);
             return pFunc;
         } else {
             log_err(this, "Codegen for function '%s' has failed, erasing\n", pszFuncName);
@@ -538,13 +1838,11 @@ namespace core {
             return nullptr;
         }
         
-        if(!pVCond->getType()->isIntegerTy()) {
+        if(!is_bool(pVCond)) {
             log_err(this, "Condition does not evaluate to boolean!\n");
             return nullptr;
         }
         
-        // Check equality of the condition and '1'
-        pVCond = ctx.builder.CreateICmpEQ(pVCond, ConstantInt::get(ctx.ctx, APInt(1, 1)));
         Function* pFunc = ctx.builder.GetInsertBlock()->getParent();
         
         // Create then BB and the continuation BB
@@ -552,18 +1850,29 @@ namespace core {
         BasicBlock* pBBElse = BasicBlock::Create(ctx.ctx, "else", pFunc);
         
         // if 'cond' is true go to 'then' otherwise to 'else'
-        auto br = ctx.builder.CreateCondBr(pVCond, pBBThen, pBBElse);
+        auto br = create_cond_br(ctx, pVCond, pBBThen, pBBElse);
+        // The same weights as clang's __builtin_expect; counts from a
+        // profile, when there are any, are what's measured instead
+        if(hint != branch_hint::none && !br->getMetadata(LLVMContext::MD_prof)) {
+            auto likely = hint == branch_hint::likely;
+            br->setMetadata(LLVMContext::MD_prof, MDBuilder(ctx.ctx).createBranchWeights(likely ? 2000 : 1, likely ? 1 : 2000));
+        }
         
         // Generate 'then' code
         ctx.builder.SetInsertPoint(pBBThen);
+        // What the branch declares isn't visible after it
+        auto outer_locals = ctx.locals;
         Value* pVThen = line->generate_ir(ctx);
+        ctx.locals = std::move(outer_locals);
         if(!pVThen) {
             log_err(line.get(), "Error after branch\n");
             return nullptr;
         }
         
-        // Unconditional jump to the 'else' block
-        ctx.builder.CreateBr(pBBElse);
+        // Unconditional jump to the 'else' block, unless the line has returned
+        if(!ctx.builder.GetInsertBlock()->getTerminator()) {
+            ctx.builder.CreateBr(pBBElse);
+        }
         pBBThen = ctx.builder.GetInsertBlock();
         
         //pFunc->getBasicBlockList().push_back(pBBElse);
@@ -572,6 +1881,404 @@ namespace core {
         return br;
     }
     
+    // Generates the lines of a loop body; nothing after a return is generated.
+    // What the body declares isn't visible after it, as arena memory of the
+    // body is released at the end of every iteration
+    static bool generate_body(llvm_ctx& ctx, std::vector<up<ast_expression>>& body) {
+        auto outer_locals = ctx.locals;
+        auto outer_depths = ctx.local_depths;
+        ctx.loop_depth++;
+        bool succ = true;
+        for(auto& line : body) {
+            if(!line->generate_ir(ctx)) {
+                succ = false;
+                break;
+            }
+            if(ctx.builder.GetInsertBlock()->getTerminator()) {
+                break;
+            }
+        }
+        ctx.loop_depth--;
+        ctx.locals = std::move(outer_locals);
+        ctx.local_depths = std::move(outer_depths);
+        return succ;
+    }
+    
+    // Attaches the hints to the back edge of a loop
+    static void set_loop_metadata(llvm_ctx& ctx, llvm::BranchInst* pLatch, const loop_hints& hints) {
+        auto pTyInt32 = Type::getInt32Ty(ctx.ctx);
+        llvm::SmallVector<Metadata*, 4> ops;
+        ops.push_back(nullptr); // Reserved for the self reference
+        
+        if(hints.unroll) {
+            if(hints.unroll_count) {
+                ops.push_back(MDNode::get(ctx.ctx, { MDString::get(ctx.ctx, "llvm.loop.unroll.count"), ConstantAsMetadata::get(ConstantInt::get(pTyInt32, hints.unroll_count)) }));
+            } else {
+                ops.push_back(MDNode::get(ctx.ctx, { MDString::get(ctx.ctx, "llvm.loop.unroll.enable") }));
+            }
+        }
+        if(hints.vectorize) {
+            ops.push_back(MDNode::get(ctx.ctx, { MDString::get(ctx.ctx, "llvm.loop.vectorize.enable"), ConstantAsMetadata::get(ConstantInt::getTrue(ctx.ctx)) }));
+            if(hints.vectorize_width) {
+                ops.push_back(MDNode::get(ctx.ctx, { MDString::get(ctx.ctx, "llvm.loop.vectorize.width"), ConstantAsMetadata::get(ConstantInt::get(pTyInt32, hints.vectorize_width)) }));
+            }
+        }
+        
+        if(ops.size() == 1) {
+            return;
+        }
+        
+        auto pLoopID = MDNode::getDistinct(ctx.ctx, ops);
+        pLoopID->replaceOperandWith(0, pLoopID);
+        pLatch->setMetadata(LLVMContext::MD_loop, pLoopID);
+    }
+    
+    llvm::Value* ast_while::generate_ir(llvm_ctx& ctx) {
+        set_debug_loc(ctx, line, col);
+        
+        Function* pFunc = ctx.builder.GetInsertBlock()->getParent();
+        BasicBlock* pBBCond = BasicBlock::Create(ctx.ctx, "while.cond", pFunc);
+        BasicBlock* pBBBody = BasicBlock::Create(ctx.ctx, "while.body", pFunc);
+        BasicBlock* pBBEnd = BasicBlock::Create(ctx.ctx, "while.end", pFunc);
+        
+        ctx.builder.CreateBr(pBBCond);
+        ctx.builder.SetInsertPoint(pBBCond);
+        
+        Value* pVCond = condition->generate_ir(ctx);
+        if(!pVCond) {
+            log_err(this, "Bad condition\n");
+            return nullptr;
+        }
+        if(!is_bool(pVCond)) {
+            log_err(condition.get(), "Condition does not evaluate to boolean!\n");
+            return nullptr;
+        }
+        create_cond_br(ctx, pVCond, pBBBody, pBBEnd);
+        
+        ctx.builder.SetInsertPoint(pBBBody);
+        size_t n_allocs = ctx.arena_allocs;
+        if(!generate_body(ctx, body)) {
+            log_err(this, "Error in loop body\n");
+            return nullptr;
+        }
+        if(!ctx.builder.GetInsertBlock()->getTerminator()) {
+            release_iteration(ctx, pBBBody, n_allocs);
+            set_loop_metadata(ctx, ctx.builder.CreateBr(pBBCond), hints);
+        }
+        
+        ctx.builder.SetInsertPoint(pBBEnd);
+        return pBBEnd;
+    }
+    
+    // Generates the loop of a for statement between bounds that were already
+    // evaluated
+    static llvm::Value* generate_counted_loop(llvm_ctx& ctx, ast_for* loop, llvm::Value* pVFrom, llvm::Value* pVTo) {
+        auto pTyVar = pVFrom->getType();
+        auto& body = loop->body;
+        
+        // The induction variable is only visible inside the loop
+        Function* pFunc = ctx.builder.GetInsertBlock()->getParent();
+        std::string name = loop->var.identifier->name;
+        auto pVar = create_entry_block_alloca(ctx, pFunc, name, pTyVar);
+        llvm::Value* pShadowed = ctx.locals.count(name) ? ctx.locals[name] : nullptr;
+        ctx.locals[name] = pVar;
+        ctx.builder.CreateStore(pVFrom, pVar);
+        
+        BasicBlock* pBBCond = BasicBlock::Create(ctx.ctx, "for.cond", pFunc);
+        BasicBlock* pBBBody = BasicBlock::Create(ctx.ctx, "for.body", pFunc);
+        BasicBlock* pBBInc = BasicBlock::Create(ctx.ctx, "for.inc", pFunc);
+        BasicBlock* pBBEnd = BasicBlock::Create(ctx.ctx, "for.end", pFunc);
+        
+        ctx.builder.CreateBr(pBBCond);
+        ctx.builder.SetInsertPoint(pBBCond);
+        auto pVIter = ctx.builder.CreateLoad(pVar, name);
+        create_cond_br(ctx, ctx.builder.CreateICmpSLT(pVIter, pVTo, "forcond"), pBBBody, pBBEnd);
+        
+        ctx.builder.SetInsertPoint(pBBBody);
+        size_t n_allocs = ctx.arena_allocs;
+        bool succ = generate_body(ctx, body);
+        if(succ && !ctx.builder.GetInsertBlock()->getTerminator()) {
+            release_iteration(ctx, pBBBody, n_allocs);
+            ctx.builder.CreateBr(pBBInc);
+        }
+        
+        ctx.builder.SetInsertPoint(pBBInc);
+        pVIter = ctx.builder.CreateLoad(pVar, name);
+        ctx.builder.CreateStore(ctx.builder.CreateNSWAdd(pVIter, ConstantInt::get(pTyVar, 1), "nextiter"), pVar);
+        set_loop_metadata(ctx, ctx.builder.CreateBr(pBBCond), loop->hints);
+        
+        if(pShadowed) {
+            ctx.locals[name] = pShadowed;
+        } else {
+            ctx.locals.erase(name);
+        }
+        
+        if(!succ) {
+            log_err(loop, "Error in loop body\n");
+            return nullptr;
+        }
+        
+        ctx.builder.SetInsertPoint(pBBEnd);
+        return pBBEnd;
+    }
+    
+    // Names of the locals used and declared in an expression
+    static void collect_names(ast_expression* expr, std::set<std::string>& used, std::set<std::string>& declared) {
+        if(!expr) {
+            return;
+        }
+        if(auto pId = dynamic_cast<ast_identifier*>(expr)) {
+            used.insert(pId->name);
+        } else if(auto pDecl = dynamic_cast<ast_declaration*>(expr)) {
+            declared.insert(pDecl->identifier->name);
+            if(auto pSlice = dynamic_cast<slice_type*>(pDecl->type.get())) {
+                used.insert(pSlice->length_name);
+            }
+        } else if(auto pFor = dynamic_cast<ast_for*>(expr)) {
+            declared.insert(pFor->var.identifier->name);
+        }
+        expr->for_each_child([&](up<ast_expression>& child) {
+            collect_names(child.get(), used, declared);
+        });
+    }
+    
+    // Iterations of a parallel loop get their own copy of the scalars, so
+    // assigning to one would be lost
+    static bool check_private_writes(ast_expression* expr, const std::set<std::string>& scalars) {
+        if(!expr) {
+            return true;
+        }
+        auto pBin = dynamic_cast<ast_binary_op*>(expr);
+        if(pBin && pBin->op == '=') {
+            auto pId = dynamic_cast<ast_identifier*>(pBin->lhs.get());
+            if(pId && scalars.count(pId->name)) {
+                log_err(pBin, "Can't assign to '%s' in a parallel loop; sums can be declared with reduce(%s)\n", pId->name, pId->name);
+                return false;
+            }
+        }
+        bool ret = true;
+        expr->for_each_child([&](up<ast_expression>& child) {
+            ret = check_private_writes(child.get(), scalars) && ret;
+        });
+        return ret;
+    }
+    
+    // A local of the enclosing function used by a parallel loop
+    struct parallel_capture {
+        std::string name;
+        llvm::Value* pOuter;
+        llvm::Type* pType;
+    };
+    
+    // Outlines the body of a parallel loop into a task function, that the
+    // runtime calls with chunks of the iteration space:
+    //   void task(i8* env, i64 begin, i64 end, i8* partial)
+    // The env holds pointers to the captured locals. Arrays are shared by
+    // reference and scalars are copied into the task. Reductions start from
+    // zero in every chunk and are added to the worker's slots in partial.
+    static llvm::Value* generate_parallel_for(llvm_ctx& ctx, ast_for* loop, llvm::Value* pVFrom, llvm::Value* pVTo) {
+        std::set<std::string> used, declared;
+        for(auto& line : loop->body) {
+            collect_names(line.get(), used, declared);
+        }
+        declared.insert(loop->var.identifier->name);
+        
+        // Real reductions come first, then the integer ones
+        std::vector<parallel_capture> reductions;
+        for(auto& name : loop->reductions) {
+            if(!ctx.locals.count(name)) {
+                log_err(loop, "Unknown variable '%s' in reduce\n", name.c_str());
+                return nullptr;
+            }
+            auto pVar = ctx.locals[name];
+            auto pType = pVar->getType()->getPointerElementType();
+            if(!pType->isDoubleTy() && !pType->isIntegerTy(64)) {
+                log_err(loop, "Only reals and ints can be reduced, '%s' is a(n) %s\n", name.c_str(), type_to_str(pType).c_str());
+                return nullptr;
+            }
+            reductions.push_back({ name, pVar, pType });
+        }
+        std::stable_partition(reductions.begin(), reductions.end(), [](const parallel_capture& c) {
+            return c.pType->isDoubleTy();
+        });
+        size_t n_real = 0;
+        for(auto& red : reductions) {
+            n_real += red.pType->isDoubleTy();
+        }
+        
+        std::vector<parallel_capture> captures;
+        std::set<std::string> scalars;
+        for(auto& name : used) {
+            bool is_reduction = std::find(loop->reductions.begin(), loop->reductions.end(), name) != loop->reductions.end();
+            if(declared.count(name) || is_reduction || !ctx.locals.count(name)) {
+                continue;
+            }
+            auto pVar = get_local(ctx, name);
+            auto pType = pVar->getType()->getPointerElementType();
+            captures.push_back({ name, pVar, pType });
+            if(!pType->isArrayTy()) {
+                scalars.insert(name);
+            }
+        }
+        for(auto& line : loop->body) {
+            if(!check_private_writes(line.get(), scalars)) {
+                return nullptr;
+            }
+        }
+        
+        auto pTyI8Ptr = Type::getInt8PtrTy(ctx.ctx);
+        auto pTyInt64 = Type::getInt64Ty(ctx.ctx);
+        Function* pParent = ctx.builder.GetInsertBlock()->getParent();
+        
+        auto pTyEnv = ArrayType::get(pTyI8Ptr, std::max<size_t>(captures.size(), 1));
+        auto pEnv = create_entry_block_alloca(ctx, pParent, "penv", pTyEnv);
+        for(size_t i = 0; i < captures.size(); i++) {
+            auto pSlot = ctx.builder.CreateConstInBoundsGEP2_32(pTyEnv, pEnv, 0, i);
+            ctx.builder.CreateStore(ctx.builder.CreateBitCast(captures[i].pOuter, pTyI8Ptr), pSlot);
+        }
+        
+        // The runtime adds the sums of the workers to the current values
+        auto pTyResults = ArrayType::get(pTyInt64, std::max<size_t>(reductions.size(), 1));
+        auto pResults = create_entry_block_alloca(ctx, pParent, "presults", pTyResults);
+        for(size_t i = 0; i < reductions.size(); i++) {
+            auto pSlot = ctx.builder.CreateConstInBoundsGEP2_32(pTyResults, pResults, 0, i);
+            pSlot = ctx.builder.CreateBitCast(pSlot, reductions[i].pOuter->getType());
+            ctx.builder.CreateStore(ctx.builder.CreateLoad(reductions[i].pOuter, reductions[i].name), pSlot);
+        }
+        
+        auto pTyTask = FunctionType::get(Type::getVoidTy(ctx.ctx), { pTyI8Ptr, pTyInt64, pTyInt64, pTyI8Ptr }, false);
+        auto pTask = Function::Create(pTyTask, Function::InternalLinkage, pParent->getName() + ".pfor", &ctx.module);
+        set_fast_math(ctx, pTask, ctx.builder.getFastMathFlags());
+        auto itArg = pTask->arg_begin();
+        Argument* pArgEnv = &*itArg++;
+        Argument* pArgBegin = &*itArg++;
+        Argument* pArgEnd = &*itArg++;
+        Argument* pArgPartial = &*itArg++;
+        pArgEnv->setName("env");
+        pArgBegin->setName("begin");
+        pArgEnd->setName("end");
+        pArgPartial->setName("partial");
+        
+        // Save the state of the enclosing function
+        BasicBlock* pBBParent = ctx.builder.GetInsertBlock();
+        auto parent_loc = ctx.builder.getCurrentDebugLocation();
+        auto parent_locals = std::move(ctx.locals);
+        auto pParentMark = ctx.arena_mark;
+        auto pParentScope = ctx.di_scope;
+        bool parent_pure = ctx.current_function_pure;
+        bool parent_in_task = ctx.in_parallel_task;
+        ctx.locals.clear();
+        ctx.arena_mark = nullptr;
+        
+        // DI
+        if(ctx.compile_unit) {
+            DIFile* pUnit = ctx.dbuilder.createFile(ctx.compile_unit->getFilename(), ctx.compile_unit->getDirectory());
+            DISubroutineType* pTySub = ctx.dbuilder.createSubroutineType(ctx.dbuilder.getOrCreateTypeArray({}));
+            DISubprogram* SP = ctx.dbuilder.createFunction(pUnit, pTask->getName(), llvm::StringRef(), pUnit, loop->line + 1, pTySub, true, true, loop->line + 1, llvm::DINode::FlagPrototyped, false);
+            pTask->setSubprogram(SP);
+            ctx.di_scope = SP;
+        }
+        // DI
+        
+        ctx.builder.SetInsertPoint(BasicBlock::Create(ctx.ctx, "entry", pTask));
+        set_debug_loc(ctx, loop->line, loop->col);
+        
+        auto pTaskEnv = ctx.builder.CreateBitCast(pArgEnv, pTyEnv->getPointerTo());
+        for(size_t i = 0; i < captures.size(); i++) {
+            auto& cap = captures[i];
+            auto pSlot = ctx.builder.CreateConstInBoundsGEP2_32(pTyEnv, pTaskEnv, 0, i);
+            auto pPtr = ctx.builder.CreateBitCast(ctx.builder.CreateLoad(pSlot), cap.pOuter->getType(), cap.name);
+            if(cap.pType->isArrayTy()) {
+                ctx.locals[cap.name] = pPtr;
+            } else {
+                auto pPrivate = create_entry_block_alloca(ctx, pTask, cap.name, cap.pType);
+                ctx.builder.CreateStore(ctx.builder.CreateLoad(pPtr), pPrivate);
+                ctx.locals[cap.name] = pPrivate;
+            }
+        }
+        for(auto& red : reductions) {
+            auto pPrivate = create_entry_block_alloca(ctx, pTask, red.name, red.pType);
+            ctx.builder.CreateStore(Constant::getNullValue(red.pType), pPrivate);
+            ctx.locals[red.name] = pPrivate;
+        }
+        
+        ctx.current_function_pure = true;
+        ctx.in_parallel_task = true;
+        bool succ = generate_counted_loop(ctx, loop, pArgBegin, pArgEnd) != nullptr;
+        if(succ) {
+            auto pPartial = ctx.builder.CreateBitCast(pArgPartial, pTyInt64->getPointerTo());
+            for(size_t i = 0; i < reductions.size(); i++) {
+                auto& red = reductions[i];
+                auto pSlot = ctx.builder.CreateConstInBoundsGEP1_32(pTyInt64, pPartial, i);
+                pSlot = ctx.builder.CreateBitCast(pSlot, red.pOuter->getType());
+                llvm::Value* pSum = ctx.builder.CreateLoad(pSlot);
+                auto pChunk = ctx.builder.CreateLoad(ctx.locals[red.name]);
+                if(red.pType->isDoubleTy()) {
+                    pSum = ctx.builder.CreateFAdd(pSum, pChunk, "redtmp");
+                } else {
+                    pSum = ctx.builder.CreateAdd(pSum, pChunk, "redtmp");
+                }
+                ctx.builder.CreateStore(pSum, pSlot);
+            }
+            ctx.builder.CreateRetVoid();
+            release_arena(ctx, pTask);
+        }
+        
+        ctx.locals = std::move(parent_locals);
+        ctx.arena_mark = pParentMark;
+        ctx.di_scope = pParentScope;
+        ctx.current_function_pure = parent_pure;
+        ctx.in_parallel_task = parent_in_task;
+        ctx.builder.SetInsertPoint(pBBParent);
+        ctx.builder.SetCurrentDebugLocation(parent_loc);
+        
+        if(!succ) {
+            pTask->eraseFromParent();
+            return nullptr;
+        }
+        
+        auto pTyRun = FunctionType::get(Type::getVoidTy(ctx.ctx), { pTyTask->getPointerTo(), pTyI8Ptr, pTyInt64, pTyInt64, pTyI8Ptr, pTyInt64, pTyInt64 }, false);
+        auto pRun = ctx.module.getOrInsertFunction("corert_parallel_for", pTyRun);
+        auto ret = ctx.builder.CreateCall(pRun, {
+            pTask, ctx.builder.CreateBitCast(pEnv, pTyI8Ptr), pVFrom, pVTo,
+            ctx.builder.CreateBitCast(pResults, pTyI8Ptr),
+            ConstantInt::get(pTyInt64, n_real), ConstantInt::get(pTyInt64, reductions.size() - n_real)
+        });
+        
+        for(size_t i = 0; i < reductions.size(); i++) {
+            auto pSlot = ctx.builder.CreateConstInBoundsGEP2_32(pTyResults, pResults, 0, i);
+            pSlot = ctx.builder.CreateBitCast(pSlot, reductions[i].pOuter->getType());
+            ctx.builder.CreateStore(ctx.builder.CreateLoad(pSlot), reductions[i].pOuter);
+        }
+        return ret;
+    }
+    
+    llvm::Value* ast_for::generate_ir(llvm_ctx& ctx) {
+        set_debug_loc(ctx, line, col);
+        
+        auto pTyVar = var.type->get_llvm_type(ctx);
+        if(!pTyVar->isIntegerTy(64)) {
+            log_err(&var, "Induction variable of a for loop must be an int!\n");
+            return nullptr;
+        }
+        
+        auto pVFrom = from->generate_ir(ctx);
+        auto pVTo = to->generate_ir(ctx);
+        if(!pVFrom || !pVTo) {
+            log_err(this, "Bad loop bounds\n");
+            return nullptr;
+        }
+        if(pVFrom->getType() != pTyVar || pVTo->getType() != pTyVar) {
+            log_err(this, "Bounds of a for loop must be integers!\n");
+            return nullptr;
+        }
+        
+        if(parallel) {
+            return generate_parallel_for(ctx, this, pVFrom, pVTo);
+        }
+        return generate_counted_loop(ctx, this, pVFrom, pVTo);
+    }
+    
     llvm::Value* ast_type::generate_ir(llvm_ctx& ctx) {
         return nullptr;
     }
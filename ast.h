@@ -2,13 +2,18 @@
 
 #include <vector>
 #include <unordered_map>
+#include <functional>
 
 #include "types.h"
 #include "type.h"
 
 #define OVERRIDE_GEN_IR() virtual llvm::Value* generate_ir(llvm_ctx& ctx) override
+#define OVERRIDE_FOR_EACH_CHILD() virtual void for_each_child(const child_fn& fn) override
 
 namespace core {
+    class ast_expression;
+    using child_fn = std::function<void(up<ast_expression>&)>;
+    
     class ast_expression {
         public:
         int line = 0, col = 0;
@@ -18,6 +23,8 @@ namespace core {
         virtual void dump() = 0;
         virtual bool is_empty() { return false; }
         virtual llvm::Value* generate_ir(llvm_ctx& ctx) { return nullptr; };
+        // Calls fn on every direct subexpression; fn may replace the child
+        virtual void for_each_child(const child_fn& fn) {}
     };
     
     class ast_empty : public ast_expression {
@@ -33,10 +40,21 @@ namespace core {
         bool is_real = false;
         bool is_int = false;
         bool is_bool = false;
+        bool is_string = false;
         virtual void dump() override;
         OVERRIDE_GEN_IR();
     };
     
+    // '{' a, b, c '}'; elements past the last one given are zero
+    class ast_array_literal : public ast_expression {
+        public:
+        std::vector<up<ast_expression>> elements;
+        
+        virtual void dump() override;
+        OVERRIDE_GEN_IR();
+        OVERRIDE_FOR_EACH_CHILD();
+    };
+    
     class ast_identifier : public ast_expression {
         public:
         
@@ -57,12 +75,41 @@ namespace core {
         OVERRIDE_GEN_IR();
     };
     
+    // Module level 'const name : type = value;', where the value is known at
+    // compile time
+    class ast_const : public ast_expression {
+        public:
+        ast_declaration decl;
+        up<ast_expression> value;
+        
+        virtual void dump() override;
+        OVERRIDE_GEN_IR();
+        OVERRIDE_FOR_EACH_CHILD();
+    };
+    
+    // Modifiers of a function besides pure; hot and cold functions are
+    // placed with the often and the rarely run code, and a flattened
+    // function has every call in its body inlined
+    enum function_attribute : unsigned {
+        fn_inline = 1 << 0,
+        fn_noinline = 1 << 1,
+        fn_hot = 1 << 2,
+        fn_cold = 1 << 3,
+        fn_flatten = 1 << 4,
+        // Every fast math flag, whatever the command line says
+        fn_fastmath = 1 << 5,
+        // Results of the pure function are cached by its arguments
+        fn_memo = 1 << 6,
+    };
+    
     class ast_prototype : public ast_expression {
         public:
         up<ast_expression> name;
         std::vector<ast_declaration> args;
         up<ast_identifier> type;
         bool is_pure;
+        // function_attribute flags
+        unsigned attributes = 0;
         
         virtual void dump() override;
         OVERRIDE_GEN_IR();
@@ -75,6 +122,7 @@ namespace core {
         
         virtual void dump() override;
         OVERRIDE_GEN_IR();
+        OVERRIDE_FOR_EACH_CHILD();
     };
     
     class ast_binary_op : public ast_expression {
@@ -88,6 +136,21 @@ namespace core {
         
         virtual void dump() override;
         OVERRIDE_GEN_IR();
+        OVERRIDE_FOR_EACH_CHILD();
+    };
+    
+    class ast_unary_op : public ast_expression {
+        public:
+        
+        ast_unary_op(char op, up<ast_expression> operand)
+            : op(op), operand(std::move(operand)) {}
+        
+        char op;
+        up<ast_expression> operand;
+        
+        virtual void dump() override;
+        OVERRIDE_GEN_IR();
+        OVERRIDE_FOR_EACH_CHILD();
     };
     
     class ast_function_call : public ast_expression {
@@ -97,14 +160,60 @@ namespace core {
         
         virtual void dump() override;
         OVERRIDE_GEN_IR();
+        OVERRIDE_FOR_EACH_CHILD();
+    };
+    
+    // Expected outcome of a condition, given by 'if likely(...)' or
+    // 'if unlikely(...)'
+    enum class branch_hint {
+        none, likely, unlikely,
     };
     
     class ast_branching : public ast_expression {
         public:
         up<ast_expression> condition;
         up<ast_expression> line;
+        branch_hint hint = branch_hint::none;
+        virtual void dump() override;
+        OVERRIDE_GEN_IR();
+        OVERRIDE_FOR_EACH_CHILD();
+    };
+    
+    // Optimization hints of a loop, emitted as llvm.loop metadata
+    struct loop_hints {
+        bool unroll = false;
+        unsigned unroll_count = 0;
+        bool vectorize = false;
+        unsigned vectorize_width = 0;
+    };
+    
+    class ast_while : public ast_expression {
+        public:
+        up<ast_expression> condition;
+        std::vector<up<ast_expression>> body;
+        loop_hints hints;
+        
+        virtual void dump() override;
+        OVERRIDE_GEN_IR();
+        OVERRIDE_FOR_EACH_CHILD();
+    };
+    
+    // Counted loop; the induction variable goes from 'from' up to, but not
+    // including 'to'
+    class ast_for : public ast_expression {
+        public:
+        ast_declaration var;
+        up<ast_expression> from, to;
+        std::vector<up<ast_expression>> body;
+        loop_hints hints;
+        // Parallel loops run their pure body on the runtime's thread pool
+        bool parallel = false;
+        // Locals the iterations of a parallel loop sum into
+        std::vector<std::string> reductions;
+        
         virtual void dump() override;
         OVERRIDE_GEN_IR();
+        OVERRIDE_FOR_EACH_CHILD();
     };
     
     class ast_type : public ast_expression {
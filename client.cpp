@@ -0,0 +1,123 @@
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "server.h"
+
+// The half of the compile server's protocol corec-client needs; it's kept
+// apart from LLVM, so the client starts quickly
+
+namespace core {
+    bool read_all(int fd, void* pBuf, size_t size) {
+        auto p = (char*)pBuf;
+        while(size > 0) {
+            auto n = read(fd, p, size);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                return false;
+            }
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+    
+    bool write_all(int fd, const void* pBuf, size_t size) {
+        auto p = (const char*)pBuf;
+        while(size > 0) {
+            auto n = send(fd, p, size, MSG_NOSIGNAL);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                return false;
+            }
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+    
+    std::string default_server_socket() {
+        auto pszDir = getenv("XDG_RUNTIME_DIR");
+        if(pszDir && *pszDir) {
+            return std::string(pszDir) + "/corec.sock";
+        }
+        return "/tmp/corec-" + std::to_string(getuid()) + ".sock";
+    }
+    
+    bool make_address(const char* pszSocket, sockaddr_un& addr) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if(strlen(pszSocket) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Socket path '%s' is too long\n", pszSocket);
+            return false;
+        }
+        strcpy(addr.sun_path, pszSocket);
+        return true;
+    }
+    
+    bool run_client(const char* pszSocket, int argc, char** argv, int& exit_code) {
+        sockaddr_un addr;
+        if(!make_address(pszSocket, addr)) {
+            return false;
+        }
+        
+        auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0) {
+            return false;
+        }
+        if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return false;
+        }
+        
+        char cwd[PATH_MAX];
+        if(!getcwd(cwd, sizeof(cwd))) {
+            close(fd);
+            return false;
+        }
+        std::string blob(cwd, strlen(cwd) + 1);
+        for(int i = 0; i < argc; i++) {
+            blob.append(argv[i], strlen(argv[i]) + 1);
+        }
+        
+        uint32_t size = blob.size();
+        int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+        char control[CMSG_SPACE(sizeof(fds))] = {};
+        iovec iov = {&size, sizeof(size)};
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        auto pCmsg = CMSG_FIRSTHDR(&msg);
+        pCmsg->cmsg_level = SOL_SOCKET;
+        pCmsg->cmsg_type = SCM_RIGHTS;
+        pCmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(pCmsg), fds, sizeof(fds));
+        
+        if(sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(size) || !write_all(fd, blob.data(), blob.size())) {
+            close(fd);
+            return false;
+        }
+        
+        // From here on the compile is the server's, whatever happens to it
+        unsigned char code;
+        if(read_all(fd, &code, 1)) {
+            exit_code = code;
+        } else {
+            fprintf(stderr, "The compile server dropped the compile\n");
+            exit_code = 1;
+        }
+        close(fd);
+        return true;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include "server.h"
+
+// corec-client: has the compile server at COREC_SERVER, or at the default
+// socket, do the compile; runs the corec next to it if there's no server
+int main(int argc, char** argv) {
+    auto pszServer = getenv("COREC_SERVER");
+    auto path = pszServer && *pszServer ? std::string(pszServer) : core::default_server_socket();
+    int exit_code;
+    if(core::run_client(path.c_str(), argc, argv, exit_code)) {
+        return exit_code;
+    }
+    
+    char exe[PATH_MAX];
+    auto len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if(len < 0) {
+        fprintf(stderr, "Couldn't find corec: %s\n", strerror(errno));
+        return 1;
+    }
+    exe[len] = 0;
+    auto pszSlash = strrchr(exe, '/');
+    std::string corec = std::string(exe, pszSlash ? pszSlash + 1 : exe) + "corec";
+    argv[0] = &corec[0];
+    execv(corec.c_str(), argv);
+    fprintf(stderr, "Couldn't run '%s': %s\n", corec.c_str(), strerror(errno));
+    return 1;
+}
\ No newline at end of file
@@ -8,13 +8,15 @@ if exists("b:current_syntax")
 endif
 
 syn keyword corFunction fn
-syn keyword corFuncAttr extern pure
+syn keyword corStorage const
+syn keyword corFuncAttr extern pure inline noinline hot cold flatten fastmath memo
 syn keyword corReturn return
-syn keyword corConditional if then
-syn keyword corType bool real
+syn keyword corConditional if then likely unlikely
+syn keyword corType bool real f32 i32 i16 i8
 syn match corFunctionName '^(?:fn)\s+(\S+)(?:[(])'
 
 hi def link corFunction Keyword
+hi def link corStorage StorageClass
 hi def link corFuncAttr Keyword
 hi def link corReturn Keyword
 hi def link corConditional Conditional
@@ -1,34 +1,1305 @@
 // Runtime library for the core language
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+// This file is also compiled to bitcode and linked into every cor module.
+// Functions pulled in that way are internalized, while non-constant globals
+// are left to the definitions in corert.o, so runtime state must not be
+// static.
 
 // Core entry point
-extern int Main(void);
+extern bool Main(void);
+
+// Output
+// Everything written to stdout goes through a per-thread buffer, which is
+// written out when it's full, on flush() and at exit
+
+#define CORERT_OUT_SIZE (1 << 20)
+// Longest formatted value plus a newline
+#define CORERT_OUT_MAX_VALUE 48
+
+_Thread_local char* corert_out_buf;
+_Thread_local size_t corert_out_len;
+
+static void write_all(int fd, const char* s, size_t n) {
+	while(n > 0) {
+		ssize_t w = write(fd, s, n);
+		if(w < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		s += w;
+		n -= w;
+	}
+}
+
+bool flush(void) {
+	if(corert_out_len) {
+		write_all(STDOUT_FILENO, corert_out_buf, corert_out_len);
+		corert_out_len = 0;
+	}
+	return true;
+}
+
+// Returns space for at least n more bytes in the output buffer
+static char* out_reserve(size_t n) {
+	if(!corert_out_buf) {
+		corert_out_buf = malloc(CORERT_OUT_SIZE);
+		if(!corert_out_buf) {
+			fprintf(stderr, "corert: can't allocate the output buffer\n");
+			abort();
+		}
+	}
+	if(corert_out_len + n > CORERT_OUT_SIZE) {
+		flush();
+	}
+	return corert_out_buf + corert_out_len;
+}
+
+// Writes the digits of v so that they end right before end; returns the first digit
+static char* format_u64(char* end, uint64_t v) {
+	do {
+		*--end = '0' + v % 10;
+		v /= 10;
+	} while(v);
+	return end;
+}
+
+static size_t format_int(char* buf, int64_t v) {
+	char tmp[24];
+	char* end = tmp + sizeof(tmp);
+	char* p = format_u64(end, v < 0 ? -(uint64_t)v : (uint64_t)v);
+	if(v < 0) {
+		*--p = '-';
+	}
+	memcpy(buf, p, end - p);
+	return end - p;
+}
+
+// Writes n / 10^k
+static size_t format_fixed(char* buf, uint64_t n, int k) {
+	char tmp[48];
+	char* end = tmp + sizeof(tmp);
+	char* p = end;
+	for(int i = 0; i < k; i++) {
+		*--p = '0' + n % 10;
+		n /= 10;
+	}
+	if(k) {
+		*--p = '.';
+	}
+	p = format_u64(p, n);
+	memcpy(buf, p, end - p);
+	return end - p;
+}
+
+static const double pow10_table[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+	1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+};
+
+// Writes the shortest decimal representation that reads back as f.
+// The fast path looks for the fewest fraction digits k, for which
+// round(f * 10^k) / 10^k is f again. Both operands of the division are
+// exact, so the division rounds the same way strtod would round the
+// decimal. Values it can't handle fall back to printf's %g, with the
+// lowest precision that still round trips.
+static size_t format_real(char* buf, double f) {
+	char* p = buf;
+	if(isnan(f)) {
+		memcpy(p, "nan", 3);
+		return 3;
+	}
+	if(signbit(f)) {
+		*p++ = '-';
+		f = -f;
+	}
+	if(isinf(f)) {
+		memcpy(p, "inf", 3);
+		return p - buf + 3;
+	}
+	
+	const double limit = 9007199254740992.0; // 2^53
+	if(f < limit) {
+		for(int k = 0; k < 18; k++) {
+			double scaled = f * pow10_table[k];
+			if(scaled >= limit) {
+				break;
+			}
+			double n = nearbyint(scaled);
+			if(n / pow10_table[k] == f) {
+				return p - buf + format_fixed(p, (uint64_t)n, k);
+			}
+		}
+	}
+	
+	int len = 0;
+	for(int prec = 15; prec <= 17; prec++) {
+		len = snprintf(p, CORERT_OUT_MAX_VALUE - 2, "%.*g", prec, f);
+		if(strtod(p, NULL) == f) {
+			break;
+		}
+	}
+	return p - buf + len;
+}
 
 double print(double f) {
-	printf("%f\n", f);
-    
+	char* p = out_reserve(CORERT_OUT_MAX_VALUE);
+	size_t n = format_real(p, f);
+	p[n] = '\n';
+	corert_out_len += n + 1;
 	return f;
 }
 
-int printbool(int b) {
-	printf("%s\n", b == 1 ? "true" : "false");
+int64_t printint(int64_t i) {
+	char* p = out_reserve(CORERT_OUT_MAX_VALUE);
+	size_t n = format_int(p, i);
+	p[n] = '\n';
+	corert_out_len += n + 1;
+	return i;
+}
+
+bool printbool(bool b) {
+	char* p = out_reserve(CORERT_OUT_MAX_VALUE);
+	if(b) {
+		memcpy(p, "true\n", 5);
+		corert_out_len += 5;
+	} else {
+		memcpy(p, "false\n", 6);
+		corert_out_len += 6;
+	}
 	return b;
 }
 
-int lnot(int b) {
-	return b == 1 ? 0 : 1;
+// Bulk printing of arrays, used by the printarr builtin
+
+void corert_print_reals(const double* a, int64_t n) {
+	for(int64_t i = 0; i < n; i++) {
+		print(a[i]);
+	}
+}
+
+void corert_print_ints(const int64_t* a, int64_t n) {
+	for(int64_t i = 0; i < n; i++) {
+		printint(a[i]);
+	}
+}
+
+void corert_print_bools(const bool* a, int64_t n) {
+	for(int64_t i = 0; i < n; i++) {
+		printbool(a[i]);
+	}
+}
+
+bool lnot(bool b) {
+	return !b;
+}
+
+bool lor(bool l, bool r) {
+    return l || r;
+}
+
+bool land(bool l, bool r) {
+    return l && r;
+}
+
+// Arena
+// Arrays that are sized at runtime or too large for the stack are bump
+// allocated from a per-thread arena. Functions mark the arena on entry and
+// release the mark before returning, which frees everything they allocated
+// at once. Blocks are mapped from the OS; with CORERT_THP=1, large blocks
+// are aligned to and advised for transparent huge pages.
+
+#define CORERT_ARENA_MIN_BLOCK (4 << 20)
+#define CORERT_ARENA_ALIGN 64
+#define CORERT_HUGE_PAGE (2 << 20)
+
+struct corert_arena_block {
+	struct corert_arena_block* prev;
+	size_t size;
+	char* cur;
+	char* end;
+};
+
+_Thread_local struct corert_arena_block* corert_arena_top;
+// The last block emptied is kept, so that allocating in a loop doesn't
+// map and unmap a block on every iteration
+_Thread_local struct corert_arena_block* corert_arena_spare;
+int corert_arena_thp = -1;
+
+static char* arena_block_data(struct corert_arena_block* b) {
+	return (char*)(b + 1);
+}
+
+static char* arena_align(char* p) {
+	return (char*)(((uintptr_t)p + CORERT_ARENA_ALIGN - 1) & ~(uintptr_t)(CORERT_ARENA_ALIGN - 1));
+}
+
+static struct corert_arena_block* arena_map_block(size_t min_size) {
+	if(corert_arena_thp == -1) {
+		const char* pszTHP = getenv("CORERT_THP");
+		corert_arena_thp = pszTHP && atoi(pszTHP) != 0;
+	}
+	
+	size_t size = min_size + sizeof(struct corert_arena_block) + CORERT_ARENA_ALIGN;
+	if(size < CORERT_ARENA_MIN_BLOCK) {
+		size = CORERT_ARENA_MIN_BLOCK;
+	}
+	bool thp = corert_arena_thp && size >= CORERT_HUGE_PAGE;
+	size_t page = thp ? CORERT_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+	size = (size + page - 1) / page * page;
+	
+	// Huge pages need an aligned mapping, so map more and trim it
+	size_t map_size = thp ? size + CORERT_HUGE_PAGE : size;
+	char* p = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) {
+		fprintf(stderr, "corert: out of memory allocating %zu bytes of arrays\n", min_size);
+		abort();
+	}
+	if(thp) {
+		char* aligned = (char*)(((uintptr_t)p + CORERT_HUGE_PAGE - 1) & ~(uintptr_t)(CORERT_HUGE_PAGE - 1));
+		if(aligned > p) {
+			munmap(p, aligned - p);
+		}
+		size_t tail = (p + map_size) - (aligned + size);
+		if(tail) {
+			munmap(aligned + size, tail);
+		}
+		p = aligned;
+		madvise(p, size, MADV_HUGEPAGE);
+	}
+	
+	struct corert_arena_block* b = (struct corert_arena_block*)p;
+	b->prev = NULL;
+	b->size = size;
+	b->cur = arena_block_data(b);
+	b->end = p + size;
+	return b;
+}
+
+static void arena_free_block(struct corert_arena_block* b) {
+	if(corert_arena_spare && corert_arena_spare->size < b->size) {
+		struct corert_arena_block* smaller = corert_arena_spare;
+		corert_arena_spare = b;
+		b = smaller;
+	} else if(!corert_arena_spare) {
+		corert_arena_spare = b;
+		return;
+	}
+	munmap(b, b->size);
+}
+
+void* corert_arena_mark(void) {
+	return corert_arena_top ? corert_arena_top->cur : NULL;
+}
+
+void* corert_arena_alloc(int64_t count, int64_t elem_size) {
+	if(count < 0) {
+		fprintf(stderr, "corert: array length is negative (%lld)\n", (long long)count);
+		abort();
+	}
+	if(count && elem_size > INT64_MAX / count) {
+		fprintf(stderr, "corert: array of %lld elements is too large\n", (long long)count);
+		abort();
+	}
+	size_t size = (size_t)(count * elem_size);
+	
+	struct corert_arena_block* b = corert_arena_top;
+	char* p = b ? arena_align(b->cur) : NULL;
+	if(!b || p > b->end || (size_t)(b->end - p) < size) {
+		struct corert_arena_block* spare = corert_arena_spare;
+		if(spare && (size_t)(spare->end - arena_align(arena_block_data(spare))) >= size) {
+			corert_arena_spare = NULL;
+			b = spare;
+			b->cur = arena_block_data(b);
+		} else {
+			b = arena_map_block(size);
+		}
+		b->prev = corert_arena_top;
+		corert_arena_top = b;
+		p = arena_align(b->cur);
+	}
+	b->cur = p + size;
+	return p;
+}
+
+// Mapped files are recorded in the arena, so they're unmapped together with
+// the arrays of the function that mapped them
+struct corert_mapping {
+	struct corert_mapping* prev;
+	void* addr;
+	size_t size;
+};
+
+_Thread_local struct corert_mapping* corert_mappings;
+
+// Unmaps the files whose records are in [from, to)
+static void unmap_released(char* from, char* to) {
+	while(corert_mappings && (char*)corert_mappings >= from && (char*)corert_mappings < to) {
+		struct corert_mapping* m = corert_mappings;
+		munmap(m->addr, m->size);
+		corert_mappings = m->prev;
+	}
+}
+
+void corert_arena_release(void* mark) {
+	char* m = (char*)mark;
+	while(corert_arena_top) {
+		struct corert_arena_block* b = corert_arena_top;
+		if(m >= arena_block_data(b) && m <= b->end) {
+			unmap_released(m, b->end);
+			b->cur = m;
+			return;
+		}
+		unmap_released(arena_block_data(b), b->end);
+		corert_arena_top = b->prev;
+		arena_free_block(b);
+	}
+}
+
+// Memory mapped files
+// Files of little-endian doubles or int64s are mapped in place of reading
+// them, so only the pages a program touches are ever loaded. Views of input
+// files are private, writes to them are never written back.
+
+enum { CORERT_MAP_NORMAL, CORERT_MAP_SEQUENTIAL, CORERT_MAP_WILLNEED, CORERT_MAP_RANDOM };
+
+static void map_advise(void* p, size_t size, int64_t hint) {
+	static const int advice[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_WILLNEED, MADV_RANDOM };
+	if(hint > CORERT_MAP_NORMAL && hint <= CORERT_MAP_RANDOM) {
+		madvise(p, size, advice[hint]);
+	}
+}
+
+static void* map_fd(int fd, const char* path, size_t size, int prot, int flags, int64_t hint) {
+	void* p = mmap(NULL, size, prot, flags, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		fprintf(stderr, "corert: can't map '%s': %s\n", path, strerror(errno));
+		abort();
+	}
+	map_advise(p, size, hint);
+	
+	struct corert_mapping* m = corert_arena_alloc(1, sizeof(struct corert_mapping));
+	m->prev = corert_mappings;
+	m->addr = p;
+	m->size = size;
+	corert_mappings = m;
+	return p;
+}
+
+void* corert_map_file(const char* path, int64_t elem_size, int64_t hint, int64_t* len) {
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if(fd == -1 || fstat(fd, &st) == -1) {
+		fprintf(stderr, "corert: can't open '%s': %s\n", path, strerror(errno));
+		abort();
+	}
+	if(st.st_size % elem_size) {
+		fprintf(stderr, "corert: size of '%s' isn't a multiple of %lld bytes\n", path, (long long)elem_size);
+		abort();
+	}
+	*len = st.st_size / elem_size;
+	if(!st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	return map_fd(fd, path, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, hint);
+}
+
+void* corert_map_output(const char* path, int64_t count, int64_t elem_size, int64_t hint) {
+	if(count < 0 || (count && elem_size > INT64_MAX / count)) {
+		fprintf(stderr, "corert: invalid length %lld for '%s'\n", (long long)count, path);
+		abort();
+	}
+	size_t size = (size_t)(count * elem_size);
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd == -1 || ftruncate(fd, size) == -1) {
+		fprintf(stderr, "corert: can't create '%s': %s\n", path, strerror(errno));
+		abort();
+	}
+	if(!size) {
+		close(fd);
+		return NULL;
+	}
+	return map_fd(fd, path, size, PROT_READ | PROT_WRITE, MAP_SHARED, hint);
+}
+
+// Sampling profiler
+// With CORERT_SAMPLE naming an output file, main() arms a SIGPROF timer,
+// CORERT_SAMPLE_HZ times per second of CPU time (100 by default). Every
+// sample walks the frame pointers of the interrupted thread, so cor code
+// should be built with -fno-omit-frame-pointer. At exit, the samples are
+// symbolized against the symbol table of the executable, or with dladdr
+// for shared libraries, and written as folded stacks for flamegraph.pl.
+
+#define CORERT_SAMPLE_DEPTH 64
+#define CORERT_MAX_SAMPLES (1 << 18)
+
+struct corert_sample {
+	int64_t depth;
+	uintptr_t pcs[CORERT_SAMPLE_DEPTH];
+};
+
+struct corert_sample* corert_samples;
+int64_t corert_n_samples;
+const char* corert_sample_path;
+// The stack of the thread, so the unwinder never leaves it
+_Thread_local uintptr_t corert_stack_lo;
+_Thread_local uintptr_t corert_stack_hi;
+
+static void sampler_thread_init(void) {
+	pthread_attr_t attr;
+	void* addr;
+	size_t size;
+	if(pthread_getattr_np(pthread_self(), &attr) == 0) {
+		if(pthread_attr_getstack(&attr, &addr, &size) == 0) {
+			corert_stack_lo = (uintptr_t)addr;
+			corert_stack_hi = (uintptr_t)addr + size;
+		}
+		pthread_attr_destroy(&attr);
+	}
+}
+
+static void sample_handler(int sig, siginfo_t* info, void* context) {
+	(void)sig;
+	(void)info;
+	ucontext_t* uc = context;
+	uintptr_t pc, fp;
+#if defined(__x86_64__)
+	pc = uc->uc_mcontext.gregs[REG_RIP];
+	fp = uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+	pc = uc->uc_mcontext.pc;
+	fp = uc->uc_mcontext.regs[29];
+#else
+	return;
+#endif
+	if(!corert_stack_hi) {
+		return;
+	}
+	int64_t i = __atomic_fetch_add(&corert_n_samples, 1, __ATOMIC_RELAXED);
+	if(i >= CORERT_MAX_SAMPLES) {
+		return;
+	}
+	
+	struct corert_sample* sample = &corert_samples[i];
+	int64_t depth = 0;
+	sample->pcs[depth++] = pc;
+	// Every frame starts with the caller's frame pointer and the return
+	// address; frames only ever go up the stack
+	while(depth < CORERT_SAMPLE_DEPTH && fp % sizeof(uintptr_t) == 0 && fp >= corert_stack_lo && fp + 2 * sizeof(uintptr_t) <= corert_stack_hi) {
+		uintptr_t* frame = (uintptr_t*)fp;
+		if(!frame[1]) {
+			break;
+		}
+		sample->pcs[depth++] = frame[1] - 1;
+		if(frame[0] <= fp) {
+			break;
+		}
+		fp = frame[0];
+	}
+	sample->depth = depth;
+}
+
+static void start_sampler(void) {
+	corert_sample_path = getenv("CORERT_SAMPLE");
+	if(!corert_sample_path) {
+		return;
+	}
+	const char* pszHz = getenv("CORERT_SAMPLE_HZ");
+	int hz = pszHz ? atoi(pszHz) : 100;
+	if(hz <= 0 || hz > 1000000) {
+		hz = 100;
+	}
+	
+	// Pages are only committed as samples are taken
+	corert_samples = mmap(NULL, (size_t)CORERT_MAX_SAMPLES * sizeof(struct corert_sample), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(corert_samples == MAP_FAILED) {
+		corert_samples = NULL;
+		fprintf(stderr, "corert: can't allocate the sample buffer\n");
+		return;
+	}
+	sampler_thread_init();
+	
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = sample_handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, NULL);
+	
+	// tv_usec has to stay below a second
+	long period = 1000000 / hz;
+	struct itimerval timer;
+	timer.it_interval.tv_sec = period / 1000000;
+	timer.it_interval.tv_usec = period % 1000000;
+	timer.it_value = timer.it_interval;
+	if(setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+		fprintf(stderr, "corert: can't start the sampling timer: %s\n", strerror(errno));
+		munmap(corert_samples, (size_t)CORERT_MAX_SAMPLES * sizeof(struct corert_sample));
+		corert_samples = NULL;
+	}
+}
+
+// Parallel loops
+// Every worker of the pool owns a range of the iterations. It takes chunks
+// from the front of its range, which shrink as the range runs out, and
+// when it runs out, it steals the upper half of another worker's range.
+// The thread that starts the loop works as worker 0.
+
+typedef void (*corert_task_fn)(void* env, int64_t begin, int64_t end, void* partial);
+
+struct corert_worker {
+	pthread_mutex_t lock;
+	int64_t begin, end;
+	// Reduction slots of the worker
+	int64_t* partial;
+} __attribute__((aligned(64)));
+
+struct corert_pool {
+	int n_workers;
+	struct corert_worker* workers;
+	
+	pthread_mutex_t lock;
+	pthread_cond_t wake, done;
+	// Incremented for every loop handed to the workers
+	uint64_t epoch;
+	// Workers still running the current loop
+	int active;
+	
+	corert_task_fn fn;
+	void* env;
+};
+
+struct corert_pool corert_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+// Loops started inside of a task run serially
+_Thread_local bool corert_in_parallel;
+
+// Takes the next chunk of the worker's own range
+static bool take_chunk(struct corert_worker* w, int64_t* begin, int64_t* end) {
+	bool ret = false;
+	pthread_mutex_lock(&w->lock);
+	int64_t remaining = w->end - w->begin;
+	if(remaining > 0) {
+		int64_t chunk = remaining / (4 * corert_pool.n_workers);
+		if(chunk < 1) {
+			chunk = 1;
+		}
+		*begin = w->begin;
+		*end = w->begin + chunk;
+		w->begin += chunk;
+		ret = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return ret;
+}
+
+// Moves the upper half of a victim's range to the thief
+static bool steal(int thief) {
+	int n = corert_pool.n_workers;
+	for(int i = 1; i < n; i++) {
+		struct corert_worker* v = &corert_pool.workers[(thief + i) % n];
+		int64_t begin = 0, end = 0;
+		pthread_mutex_lock(&v->lock);
+		int64_t remaining = v->end - v->begin;
+		if(remaining > 0) {
+			begin = v->begin + remaining / 2;
+			end = v->end;
+			v->end = begin;
+		}
+		pthread_mutex_unlock(&v->lock);
+		
+		if(begin < end) {
+			struct corert_worker* w = &corert_pool.workers[thief];
+			pthread_mutex_lock(&w->lock);
+			w->begin = begin;
+			w->end = end;
+			pthread_mutex_unlock(&w->lock);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void run_worker(int id) {
+	struct corert_worker* w = &corert_pool.workers[id];
+	int64_t begin, end;
+	for(;;) {
+		if(take_chunk(w, &begin, &end)) {
+			corert_pool.fn(corert_pool.env, begin, end, w->partial);
+		} else if(!steal(id)) {
+			break;
+		}
+	}
+}
+
+static void* worker_main(void* arg) {
+	int id = (int)(intptr_t)arg;
+	uint64_t seen = 0;
+	corert_in_parallel = true;
+	if(corert_samples) {
+		sampler_thread_init();
+	}
+	
+	pthread_mutex_lock(&corert_pool.lock);
+	for(;;) {
+		while(corert_pool.epoch == seen) {
+			pthread_cond_wait(&corert_pool.wake, &corert_pool.lock);
+		}
+		seen = corert_pool.epoch;
+		pthread_mutex_unlock(&corert_pool.lock);
+		
+		run_worker(id);
+		// Output of the loop is visible when it returns
+		flush();
+		
+		pthread_mutex_lock(&corert_pool.lock);
+		if(--corert_pool.active == 0) {
+			pthread_cond_signal(&corert_pool.done);
+		}
+	}
+	return NULL;
+}
+
+// Starts the workers on first use; CORERT_THREADS overrides the number of
+// processors
+static void start_pool(void) {
+	if(corert_pool.workers) {
+		return;
+	}
+	
+	long n = 0;
+	const char* pszThreads = getenv("CORERT_THREADS");
+	if(pszThreads) {
+		n = atol(pszThreads);
+	}
+	if(n < 1) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(n < 1) {
+		n = 1;
+	}
+	
+	struct corert_worker* workers = NULL;
+	if(posix_memalign((void**)&workers, 64, n * sizeof(struct corert_worker)) != 0) {
+		fprintf(stderr, "corert: can't allocate the thread pool\n");
+		abort();
+	}
+	for(long i = 0; i < n; i++) {
+		pthread_mutex_init(&workers[i].lock, NULL);
+		workers[i].begin = workers[i].end = 0;
+		workers[i].partial = NULL;
+	}
+	corert_pool.workers = workers;
+	corert_pool.n_workers = 1;
+	
+	for(long i = 1; i < n; i++) {
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, worker_main, (void*)(intptr_t)i) != 0) {
+			break;
+		}
+		pthread_detach(thread);
+		corert_pool.n_workers++;
+	}
+}
+
+// Runs fn over [begin, end) on the pool. results holds n_real doubles
+// followed by n_int ints; the sums computed by the workers are added to them.
+void corert_parallel_for(corert_task_fn fn, void* env, int64_t begin, int64_t end, void* results, int64_t n_real, int64_t n_int) {
+	if(begin >= end) {
+		return;
+	}
+	
+	int64_t n_results = n_real + n_int;
+	if(!corert_in_parallel) {
+		start_pool();
+	}
+	int n = corert_in_parallel ? 1 : corert_pool.n_workers;
+	
+	// Reduction slots of every worker, each on its own cache lines
+	size_t stride = ((n_results * sizeof(int64_t) + 63) / 64) * 64;
+	if(stride == 0) {
+		stride = 64;
+	}
+	int64_t* partials = NULL;
+	if(posix_memalign((void**)&partials, 64, stride * n) != 0) {
+		fprintf(stderr, "corert: can't allocate reduction slots\n");
+		abort();
+	}
+	memset(partials, 0, stride * n);
+	
+	if(n == 1) {
+		fn(env, begin, end, partials);
+	} else {
+		int64_t count = end - begin;
+		for(int i = 0; i < n; i++) {
+			struct corert_worker* w = &corert_pool.workers[i];
+			pthread_mutex_lock(&w->lock);
+			w->begin = begin + count * i / n;
+			w->end = begin + count * (i + 1) / n;
+			w->partial = (int64_t*)((char*)partials + stride * i);
+			pthread_mutex_unlock(&w->lock);
+		}
+		
+		// What was printed before the loop comes out before its output
+		flush();
+		pthread_mutex_lock(&corert_pool.lock);
+		corert_pool.fn = fn;
+		corert_pool.env = env;
+		corert_pool.active = n - 1;
+		corert_pool.epoch++;
+		pthread_cond_broadcast(&corert_pool.wake);
+		pthread_mutex_unlock(&corert_pool.lock);
+		
+		corert_in_parallel = true;
+		run_worker(0);
+		corert_in_parallel = false;
+		
+		pthread_mutex_lock(&corert_pool.lock);
+		while(corert_pool.active > 0) {
+			pthread_cond_wait(&corert_pool.done, &corert_pool.lock);
+		}
+		pthread_mutex_unlock(&corert_pool.lock);
+	}
+	
+	double* real_results = (double*)results;
+	int64_t* int_results = (int64_t*)results + n_real;
+	for(int i = 0; i < n; i++) {
+		int64_t* partial = (int64_t*)((char*)partials + stride * i);
+		for(int64_t k = 0; k < n_real; k++) {
+			real_results[k] += ((double*)partial)[k];
+		}
+		for(int64_t k = 0; k < n_int; k++) {
+			int_results[k] += partial[n_real + k];
+		}
+	}
+	free(partials);
+}
+
+// Profiles
+// Programs built with -fprofile-generate register their counters from a
+// constructor, once per instrumented object. Every function has an entry
+// counter followed by a taken and a not taken counter per branch. The counts
+// are written at exit, to the file named at compile time or to
+// CORERT_PROFILE; objects naming the same file share it.
+
+struct corert_prof_function {
+	const char* name;
+	int64_t first;
+	int64_t n_branches;
+};
+
+struct corert_prof_module {
+	const struct corert_prof_function* functions;
+	int64_t n_functions;
+	const int64_t* counters;
+	const char* path;
+	struct corert_prof_module* next;
+};
+
+// Newest first
+struct corert_prof_module* corert_prof_modules;
+
+void corert_profile_register(const struct corert_prof_function* functions, int64_t n_functions, const int64_t* counters, const char* path) {
+	struct corert_prof_module* module = malloc(sizeof(*module));
+	if(!module) {
+		fprintf(stderr, "corert: can't allocate a profile\n");
+		abort();
+	}
+	module->functions = functions;
+	module->n_functions = n_functions;
+	module->counters = counters;
+	module->path = path;
+	struct corert_prof_module* head = __atomic_load_n(&corert_prof_modules, __ATOMIC_RELAXED);
+	do {
+		module->next = head;
+	} while(!__atomic_compare_exchange_n(&corert_prof_modules, &head, module, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static const char* profile_path(const struct corert_prof_module* module) {
+	const char* path = getenv("CORERT_PROFILE");
+	return path ? path : module->path;
+}
+
+static void write_profile_functions(FILE* f, const struct corert_prof_module* module) {
+	for(int64_t i = 0; i < module->n_functions; i++) {
+		const struct corert_prof_function* fn = &module->functions[i];
+		const int64_t* c = module->counters + fn->first;
+		fprintf(f, "fn %s %lld %lld\n", fn->name, (long long)c[0], (long long)fn->n_branches);
+		for(int64_t j = 0; j < fn->n_branches; j++) {
+			fprintf(f, "%lld %lld\n", (long long)c[1 + 2 * j], (long long)c[2 + 2 * j]);
+		}
+	}
+}
+
+static void write_profile(void) {
+	for(struct corert_prof_module* module = corert_prof_modules; module; module = module->next) {
+		const char* path = profile_path(module);
+		// Written along with an earlier object
+		bool written = false;
+		for(struct corert_prof_module* prev = corert_prof_modules; prev != module; prev = prev->next) {
+			written = written || strcmp(profile_path(prev), path) == 0;
+		}
+		if(written) {
+			continue;
+		}
+		
+		FILE* f = fopen(path, "w");
+		if(!f) {
+			fprintf(stderr, "corert: can't write profile '%s': %s\n", path, strerror(errno));
+			continue;
+		}
+		fprintf(f, "# corec profile 1\n");
+		for(struct corert_prof_module* other = module; other; other = other->next) {
+			if(other == module || strcmp(profile_path(other), path) == 0) {
+				write_profile_functions(f, other);
+			}
+		}
+		fclose(f);
+	}
+}
+
+// Function instrumentation
+// With -finstrument-functions, every function calls corert_func_enter and
+// corert_func_exit with its slot. Each thread keeps a stack of the calls in
+// progress, so the time spent in callees is taken off the exclusive time of
+// the caller; the inclusive time of a recursive function counts the nested
+// calls again. Slots are linked into a list on their first call, which is
+// printed at exit sorted by exclusive time, or written as CSV to the file
+// named by CORERT_INSTRUMENT_CSV.
+
+struct corert_func_slot {
+	const char* name;
+	struct corert_func_slot* next;
+	int64_t calls;
+	int64_t inclusive;
+	int64_t exclusive;
+};
+
+struct corert_func_frame {
+	struct corert_func_slot* slot;
+	int64_t start;
+	int64_t children;
+};
+
+// Calls nested deeper than this are counted, but not timed
+#define CORERT_MAX_FRAMES 4096
+
+struct corert_func_slot* corert_func_slots;
+_Thread_local struct corert_func_frame corert_func_frames[CORERT_MAX_FRAMES];
+_Thread_local int corert_func_depth;
+
+static int64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+double now(void) {
+	return now_ns() * 1e-9;
+}
+
+void corert_func_enter(struct corert_func_slot* slot) {
+	if(__atomic_fetch_add(&slot->calls, 1, __ATOMIC_RELAXED) == 0) {
+		struct corert_func_slot* head = __atomic_load_n(&corert_func_slots, __ATOMIC_RELAXED);
+		do {
+			slot->next = head;
+		} while(!__atomic_compare_exchange_n(&corert_func_slots, &head, slot, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+	int depth = corert_func_depth++;
+	if(depth < CORERT_MAX_FRAMES) {
+		struct corert_func_frame* frame = &corert_func_frames[depth];
+		frame->slot = slot;
+		frame->children = 0;
+		frame->start = now_ns();
+	}
+}
+
+void corert_func_exit(struct corert_func_slot* slot) {
+	int depth = --corert_func_depth;
+	if(depth >= CORERT_MAX_FRAMES) {
+		return;
+	}
+	int64_t elapsed = now_ns() - corert_func_frames[depth].start;
+	__atomic_fetch_add(&slot->inclusive, elapsed, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&slot->exclusive, elapsed - corert_func_frames[depth].children, __ATOMIC_RELAXED);
+	if(depth > 0) {
+		corert_func_frames[depth - 1].children += elapsed;
+	}
+}
+
+static int compare_exclusive(const void* a, const void* b) {
+	const struct corert_func_slot* l = *(const struct corert_func_slot* const*)a;
+	const struct corert_func_slot* r = *(const struct corert_func_slot* const*)b;
+	return (l->exclusive < r->exclusive) - (l->exclusive > r->exclusive);
+}
+
+static void write_function_times(void) {
+	size_t n = 0;
+	for(struct corert_func_slot* slot = corert_func_slots; slot; slot = slot->next) {
+		n++;
+	}
+	struct corert_func_slot** slots = malloc(n * sizeof(*slots));
+	if(!slots) {
+		return;
+	}
+	n = 0;
+	for(struct corert_func_slot* slot = corert_func_slots; slot; slot = slot->next) {
+		slots[n++] = slot;
+	}
+	qsort(slots, n, sizeof(*slots), compare_exclusive);
+	
+	const char* csv = getenv("CORERT_INSTRUMENT_CSV");
+	FILE* f = csv ? fopen(csv, "w") : stderr;
+	if(!f) {
+		fprintf(stderr, "corert: can't write '%s': %s\n", csv, strerror(errno));
+		free(slots);
+		return;
+	}
+	if(csv) {
+		fprintf(f, "function,calls,inclusive_ns,exclusive_ns\n");
+	} else {
+		fprintf(f, "%14s %14s %14s  %s\n", "calls", "inclusive ms", "exclusive ms", "function");
+	}
+	for(size_t i = 0; i < n; i++) {
+		struct corert_func_slot* slot = slots[i];
+		if(csv) {
+			fprintf(f, "%s,%lld,%lld,%lld\n", slot->name, (long long)slot->calls, (long long)slot->inclusive, (long long)slot->exclusive);
+		} else {
+			fprintf(f, "%14lld %14.3f %14.3f  %s\n", (long long)slot->calls, slot->inclusive * 1e-6, slot->exclusive * 1e-6, slot->name);
+		}
+	}
+	if(csv) {
+		fclose(f);
+	}
+	free(slots);
+}
+
+// Memoization
+// Every memo function has a fixed size open addressing table, allocated on
+// its first call. An entry is the hash of the arguments, which is never 0
+// for an entry in use, the result and the arguments. An argument tuple is
+// looked for in the CORERT_MEMO_PROBES entries after its hash; when they're
+// all in use, the one at the hash is replaced. The table is only locked
+// while a parallel loop runs, as no other thread runs cor code otherwise.
+// The hits and misses of every function are printed at exit if
+// CORERT_MEMO_STATS is set.
+
+#define CORERT_MEMO_SIZE (1 << 16)
+#define CORERT_MEMO_PROBES 8
+
+struct corert_memo {
+	const char* name;
+	struct corert_memo* next;
+	int64_t n_args;
+	int64_t hits;
+	int64_t misses;
+	int64_t* table;
+	int64_t lock;
+};
+
+struct corert_memo* corert_memos;
+
+static uint64_t memo_hash(const int64_t* keys, int64_t n) {
+	uint64_t h = n;
+	for(int64_t i = 0; i < n; i++) {
+		h = (h ^ (uint64_t)keys[i]) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 32;
+	}
+	return h | 1;
+}
+
+static int64_t* memo_entry(struct corert_memo* memo, uint64_t i) {
+	return memo->table + (i & (CORERT_MEMO_SIZE - 1)) * (memo->n_args + 2);
+}
+
+static bool memo_matches(struct corert_memo* memo, const int64_t* e, uint64_t hash, const int64_t* keys) {
+	return (uint64_t)e[0] == hash && memcmp(e + 2, keys, memo->n_args * sizeof(int64_t)) == 0;
+}
+
+static void memo_lock(struct corert_memo* memo) {
+	if(corert_in_parallel) {
+		while(__atomic_exchange_n(&memo->lock, 1, __ATOMIC_ACQUIRE)) {
+			while(__atomic_load_n(&memo->lock, __ATOMIC_RELAXED)) {
+			}
+		}
+	}
+}
+
+static void memo_unlock(struct corert_memo* memo) {
+	if(corert_in_parallel) {
+		__atomic_store_n(&memo->lock, 0, __ATOMIC_RELEASE);
+	}
+}
+
+bool corert_memo_lookup(struct corert_memo* memo, const int64_t* keys, int64_t* result) {
+	uint64_t hash = memo_hash(keys, memo->n_args);
+	bool found = false;
+	memo_lock(memo);
+	if(!memo->table) {
+		memo->table = calloc(CORERT_MEMO_SIZE, (memo->n_args + 2) * sizeof(int64_t));
+		if(!memo->table) {
+			fprintf(stderr, "corert: can't allocate the memo table of '%s'\n", memo->name);
+			abort();
+		}
+		struct corert_memo* head = __atomic_load_n(&corert_memos, __ATOMIC_RELAXED);
+		do {
+			memo->next = head;
+		} while(!__atomic_compare_exchange_n(&corert_memos, &head, memo, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+	for(uint64_t i = 0; i < CORERT_MEMO_PROBES; i++) {
+		int64_t* e = memo_entry(memo, hash + i);
+		if(e[0] == 0) {
+			break;
+		}
+		if(memo_matches(memo, e, hash, keys)) {
+			*result = e[1];
+			found = true;
+			break;
+		}
+	}
+	if(found) {
+		memo->hits++;
+	} else {
+		memo->misses++;
+	}
+	memo_unlock(memo);
+	return found;
+}
+
+void corert_memo_store(struct corert_memo* memo, const int64_t* keys, int64_t result) {
+	uint64_t hash = memo_hash(keys, memo->n_args);
+	memo_lock(memo);
+	int64_t* victim = memo_entry(memo, hash);
+	for(uint64_t i = 0; i < CORERT_MEMO_PROBES; i++) {
+		int64_t* e = memo_entry(memo, hash + i);
+		if(e[0] == 0 || memo_matches(memo, e, hash, keys)) {
+			victim = e;
+			break;
+		}
+	}
+	victim[0] = hash;
+	victim[1] = result;
+	memcpy(victim + 2, keys, memo->n_args * sizeof(int64_t));
+	memo_unlock(memo);
+}
+
+static void write_memo_stats(void) {
+	fprintf(stderr, "%14s %14s  %s\n", "hits", "misses", "function");
+	for(struct corert_memo* memo = corert_memos; memo; memo = memo->next) {
+		fprintf(stderr, "%14lld %14lld  %s\n", (long long)memo->hits, (long long)memo->misses, memo->name);
+	}
+}
+
+struct corert_symbol {
+	uintptr_t addr;
+	uintptr_t size;
+	const char* name;
+};
+
+struct corert_symbols {
+	struct corert_symbol* syms;
+	size_t n;
+};
+
+static int compare_symbols(const void* a, const void* b) {
+	const struct corert_symbol* l = a;
+	const struct corert_symbol* r = b;
+	return (l->addr > r->addr) - (l->addr < r->addr);
+}
+
+static int find_load_base(struct dl_phdr_info* info, size_t size, void* data) {
+	(void)size;
+	// The executable comes first
+	*(uintptr_t*)data = info->dlpi_addr;
+	return 1;
+}
+
+// Reads the function symbols of the executable; the file stays mapped for
+// the names
+static struct corert_symbols read_symbols(void) {
+	struct corert_symbols ret = { NULL, 0 };
+	int fd = open("/proc/self/exe", O_RDONLY);
+	struct stat st;
+	if(fd == -1 || fstat(fd, &st) == -1) {
+		return ret;
+	}
+	char* image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(image == MAP_FAILED) {
+		return ret;
+	}
+	
+	Elf64_Ehdr* ehdr = (Elf64_Ehdr*)image;
+	if((size_t)st.st_size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64) {
+		return ret;
+	}
+	uintptr_t base = 0;
+	dl_iterate_phdr(find_load_base, &base);
+	
+	Elf64_Shdr* shdrs = (Elf64_Shdr*)(image + ehdr->e_shoff);
+	for(int i = 0; i < ehdr->e_shnum; i++) {
+		if(shdrs[i].sh_type != SHT_SYMTAB) {
+			continue;
+		}
+		Elf64_Sym* syms = (Elf64_Sym*)(image + shdrs[i].sh_offset);
+		size_t n = shdrs[i].sh_size / sizeof(Elf64_Sym);
+		const char* strtab = image + shdrs[shdrs[i].sh_link].sh_offset;
+		ret.syms = malloc(n * sizeof(struct corert_symbol));
+		if(!ret.syms) {
+			return ret;
+		}
+		for(size_t j = 0; j < n; j++) {
+			if(ELF64_ST_TYPE(syms[j].st_info) == STT_FUNC && syms[j].st_value) {
+				struct corert_symbol* sym = &ret.syms[ret.n++];
+				sym->addr = base + syms[j].st_value;
+				sym->size = syms[j].st_size;
+				sym->name = strtab + syms[j].st_name;
+			}
+		}
+		qsort(ret.syms, ret.n, sizeof(struct corert_symbol), compare_symbols);
+		break;
+	}
+	return ret;
+}
+
+static const char* symbolize(const struct corert_symbols* symbols, uintptr_t pc) {
+	size_t lo = 0, hi = symbols->n;
+	while(lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if(symbols->syms[mid].addr <= pc) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if(lo > 0) {
+		const struct corert_symbol* sym = &symbols->syms[lo - 1];
+		if(pc < sym->addr + (sym->size ? sym->size : 1)) {
+			return sym->name;
+		}
+	}
+	Dl_info info;
+	if(dladdr((void*)pc, &info) && info.dli_sname) {
+		return info.dli_sname;
+	}
+	return "[unknown]";
+}
+
+static int compare_strings(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
 }
 
-int lor(int l, int r) {
-    return (l || r) ? 1 : 0;
+static void write_samples(void) {
+	struct itimerval off;
+	memset(&off, 0, sizeof(off));
+	setitimer(ITIMER_PROF, &off, NULL);
+	
+	int64_t n = corert_n_samples;
+	if(n > CORERT_MAX_SAMPLES) {
+		fprintf(stderr, "corert: sample buffer full, %lld samples dropped\n", (long long)(n - CORERT_MAX_SAMPLES));
+		n = CORERT_MAX_SAMPLES;
+	}
+	FILE* f = fopen(corert_sample_path, "w");
+	if(!f) {
+		fprintf(stderr, "corert: can't write samples to '%s': %s\n", corert_sample_path, strerror(errno));
+		return;
+	}
+	
+	// Folded stacks go from the root to the leaf, separated by ';'
+	struct corert_symbols symbols = read_symbols();
+	char** stacks = malloc(n * sizeof(char*));
+	int64_t n_stacks = 0;
+	for(int64_t i = 0; stacks && i < n; i++) {
+		struct corert_sample* sample = &corert_samples[i];
+		size_t len = 0;
+		int64_t depth = sample->depth;
+		const char* names[CORERT_SAMPLE_DEPTH];
+		for(int64_t j = 0; j < depth; j++) {
+			names[j] = symbolize(&symbols, sample->pcs[j]);
+			len += strlen(names[j]) + 1;
+			// The frames of libc above main and the workers aren't interesting
+			if(strcmp(names[j], "main") == 0 || strcmp(names[j], "worker_main") == 0) {
+				depth = j + 1;
+			}
+		}
+		char* stack = malloc(len + 1);
+		if(!stack) {
+			break;
+		}
+		char* p = stack;
+		for(int64_t j = depth - 1; j >= 0; j--) {
+			size_t l = strlen(names[j]);
+			memcpy(p, names[j], l);
+			p += l;
+			*p++ = j ? ';' : 0;
+		}
+		*p = 0;
+		stacks[n_stacks++] = stack;
+	}
+	
+	qsort(stacks, n_stacks, sizeof(char*), compare_strings);
+	for(int64_t i = 0; i < n_stacks;) {
+		int64_t j = i + 1;
+		while(j < n_stacks && strcmp(stacks[i], stacks[j]) == 0) {
+			j++;
+		}
+		fprintf(f, "%s %lld\n", stacks[i], (long long)(j - i));
+		for(; i < j; i++) {
+			free(stacks[i]);
+		}
+	}
+	free(stacks);
+	free(symbols.syms);
+	fclose(f);
 }
 
-int land(int l, int r) {
-    return (l && r) ? 1 : 0;
+static void corert_at_exit(void) {
+	flush();
+	if(corert_prof_modules) {
+		write_profile();
+	}
+	if(corert_func_slots) {
+		write_function_times();
+	}
+	if(corert_memos && getenv("CORERT_MEMO_STATS")) {
+		write_memo_stats();
+	}
+	if(corert_samples) {
+		write_samples();
+	}
 }
 
 int main(int argc, char** argv) {
+	atexit(corert_at_exit);
+	start_sampler();
 	return Main() ? 0 : -1;
 }
 
@@ -0,0 +1,498 @@
+#include "stdafx.h"
+#include <cmath>
+#include <climits>
+#include <cstdlib>
+
+#include "fold.h"
+#include "log.h"
+
+namespace core {
+    // A value known at compile time
+    struct fold_value {
+        enum { real, integer, boolean } kind;
+        double r = 0.0;
+        long long i = 0;
+        bool b = false;
+    };
+    
+    struct fold_state {
+        fold_state(llvm_ctx& ctx) : ctx(ctx) {}
+        
+        llvm_ctx& ctx;
+        // How many times each local is assigned to in the function
+        std::unordered_map<std::string, int> assignments;
+        // Type names of the declared locals
+        std::unordered_map<std::string, std::string> decl_types;
+        // Locals that are known to hold a constant
+        std::unordered_map<std::string, fold_value> constants;
+        // Assignments inside of a branch are conditional
+        int depth = 0;
+    };
+    
+    static bool get_value(const ast_expression* expr, fold_value& v) {
+        auto pLit = dynamic_cast<const ast_literal*>(expr);
+        if(!pLit) {
+            return false;
+        }
+        
+        char* end = nullptr;
+        if(pLit->is_real) {
+            v.kind = fold_value::real;
+            v.r = strtod(pLit->value.c_str(), &end);
+        } else if(pLit->is_int) {
+            v.kind = fold_value::integer;
+            v.i = strtoll(pLit->value.c_str(), &end, 10);
+        } else if(pLit->is_bool) {
+            v.kind = fold_value::boolean;
+            v.b = pLit->value == "true";
+            return true;
+        } else {
+            return false;
+        }
+        
+        return end && *end == 0;
+    }
+    
+    static up<ast_expression> make_literal(const fold_value& v, const ast_expression* at) {
+        char buf[64];
+        switch(v.kind) {
+            case fold_value::real:
+            snprintf(buf, 64, "%.17g", v.r);
+            if(!strpbrk(buf, ".e")) {
+                strncat(buf, ".0", 63 - strlen(buf));
+            }
+            break;
+            case fold_value::integer:
+            snprintf(buf, 64, "%lld", v.i);
+            break;
+            case fold_value::boolean:
+            snprintf(buf, 64, "%s", v.b ? "true" : "false");
+            break;
+        }
+        
+        auto ret = std::make_unique<ast_literal>(buf);
+        ret->is_real = v.kind == fold_value::real;
+        ret->is_int = v.kind == fold_value::integer;
+        ret->is_bool = v.kind == fold_value::boolean;
+        ret->line = at->line; ret->col = at->col;
+        return ret;
+    }
+    
+    static double as_real(const fold_value& v) {
+        return v.kind == fold_value::integer ? (double)v.i : v.r;
+    }
+    
+    // Results that aren't finite are left to run time
+    static bool fold_real_op(char op, double a, double b, fold_value& out) {
+        out.kind = fold_value::real;
+        switch(op) {
+            case '+': out.r = a + b; return std::isfinite(out.r);
+            case '-': out.r = a - b; return std::isfinite(out.r);
+            case '*': out.r = a * b; return std::isfinite(out.r);
+            case '/': out.r = a / b; return std::isfinite(out.r);
+        }
+        // Comparisons are unordered, like the fcmp's generated for them
+        out.kind = fold_value::boolean;
+        switch(op) {
+            case '?': out.b = std::isnan(a) || std::isnan(b) || a == b; return true;
+            case '!': out.b = a != b; return true;
+            case '<': out.b = !(a >= b); return true;
+            case '>': out.b = !(a <= b); return true;
+        }
+        return false;
+    }
+    
+    // Returns the name of the local an assignment writes to
+    static const char* assigned_name(const ast_binary_op* expr) {
+        if(expr->op != '=') {
+            return nullptr;
+        }
+        if(auto pDecl = dynamic_cast<ast_declaration*>(expr->lhs.get())) {
+            return pDecl->identifier->name;
+        }
+        if(auto pId = dynamic_cast<ast_identifier*>(expr->lhs.get())) {
+            return pId->name;
+        }
+        return nullptr;
+    }
+    
+    static bool fold_binary_op(const ast_binary_op* expr, const fold_value& l, const fold_value& r, fold_value& out) {
+        if(l.kind == fold_value::boolean || r.kind == fold_value::boolean) {
+            return false;
+        }
+        
+        if(l.kind == fold_value::integer && r.kind == fold_value::integer) {
+            long long a = l.i, b = r.i;
+            out.kind = fold_value::integer;
+            switch(expr->op) {
+                case '+': return !__builtin_add_overflow(a, b, &out.i);
+                case '-': return !__builtin_sub_overflow(a, b, &out.i);
+                case '*': return !__builtin_mul_overflow(a, b, &out.i);
+                case '/':
+                if(b == 0 || (a == LLONG_MIN && b == -1)) {
+                    return false;
+                }
+                out.i = a / b;
+                return true;
+            }
+            out.kind = fold_value::boolean;
+            switch(expr->op) {
+                case '?': out.b = a == b; return true;
+                case '!': out.b = a != b; return true;
+                case '<': out.b = a < b; return true;
+                case '>': out.b = a > b; return true;
+            }
+            return false;
+        }
+        
+        if(!fold_real_op(expr->op, as_real(l), as_real(r), out)) {
+            return false;
+        }
+        // Same as the implicit conversion done in codegen, which only warns
+        // about what isn't folded
+        if(l.kind == fold_value::integer) {
+            log_warn(expr->lhs.get(), "Implicitly converting integer to real!\n");
+        } else if(r.kind == fold_value::integer) {
+            log_warn(expr->rhs.get(), "Implicitly converting integer to real!\n");
+        }
+        return true;
+    }
+    
+    // Evaluates pure math functions known to the runtime
+    static bool eval_math(const char* pszName, const std::vector<double>& a, double& res) {
+        if(strcmp(pszName, "sin") == 0 && a.size() == 1) {
+            res = std::sin(a[0]);
+        } else if(strcmp(pszName, "cos") == 0 && a.size() == 1) {
+            res = std::cos(a[0]);
+        } else if(strcmp(pszName, "sqrt") == 0 && a.size() == 1) {
+            res = std::sqrt(a[0]);
+        } else if(strcmp(pszName, "exp") == 0 && a.size() == 1) {
+            res = std::exp(a[0]);
+        } else if(strcmp(pszName, "exp2") == 0 && a.size() == 1) {
+            res = std::exp2(a[0]);
+        } else if(strcmp(pszName, "log") == 0 && a.size() == 1) {
+            res = std::log(a[0]);
+        } else if(strcmp(pszName, "log2") == 0 && a.size() == 1) {
+            res = std::log2(a[0]);
+        } else if(strcmp(pszName, "log10") == 0 && a.size() == 1) {
+            res = std::log10(a[0]);
+        } else if(strcmp(pszName, "fabs") == 0 && a.size() == 1) {
+            res = std::fabs(a[0]);
+        } else if(strcmp(pszName, "floor") == 0 && a.size() == 1) {
+            res = std::floor(a[0]);
+        } else if(strcmp(pszName, "ceil") == 0 && a.size() == 1) {
+            res = std::ceil(a[0]);
+        } else if(strcmp(pszName, "fmod") == 0 && a.size() == 2) {
+            res = std::fmod(a[0], a[1]);
+        } else if(strcmp(pszName, "pow") == 0 && a.size() == 2) {
+            res = std::pow(a[0], a[1]);
+        } else if(strcmp(pszName, "fmin") == 0 && a.size() == 2) {
+            res = std::fmin(a[0], a[1]);
+        } else if(strcmp(pszName, "fmax") == 0 && a.size() == 2) {
+            res = std::fmax(a[0], a[1]);
+        } else if(strcmp(pszName, "fma") == 0 && a.size() == 3) {
+            res = std::fma(a[0], a[1], a[2]);
+        } else {
+            return false;
+        }
+        return std::isfinite(res);
+    }
+    
+    // Folds '&&' and '||'; a constant left-hand side decides whether the
+    // right-hand side would be evaluated at all
+    static void fold_logical(up<ast_expression>& expr) {
+        auto pBin = static_cast<ast_binary_op*>(expr.get());
+        bool is_and = pBin->op == '&';
+        fold_value l, r;
+        if(get_value(pBin->lhs.get(), l) && l.kind == fold_value::boolean) {
+            if(l.b == is_and) {
+                expr = std::move(pBin->rhs);
+            } else {
+                expr = std::move(pBin->lhs);
+            }
+        } else if(get_value(pBin->rhs.get(), r) && r.kind == fold_value::boolean && r.b == is_and) {
+            expr = std::move(pBin->lhs);
+        }
+    }
+    
+    // Folds lnot, land and lor, which are lowered inline by codegen
+    static bool fold_logic_builtin(const ast_function_call* expr, fold_state& st, fold_value& out) {
+        auto pszName = expr->name->name;
+        bool is_not = strcmp(pszName, "lnot") == 0;
+        if(!is_not && strcmp(pszName, "land") != 0 && strcmp(pszName, "lor") != 0) {
+            return false;
+        }
+        auto pFunc = st.ctx.module.getFunction(pszName);
+        if(pFunc && !pFunc->isDeclaration()) {
+            return false;
+        }
+        if(expr->args.size() != (is_not ? 1 : 2)) {
+            return false;
+        }
+        
+        bool args[2];
+        for(size_t i = 0; i < expr->args.size(); i++) {
+            fold_value v;
+            if(!get_value(expr->args[i].get(), v) || v.kind != fold_value::boolean) {
+                return false;
+            }
+            args[i] = v.b;
+        }
+        
+        out.kind = fold_value::boolean;
+        if(is_not) {
+            out.b = !args[0];
+        } else if(strcmp(pszName, "land") == 0) {
+            out.b = args[0] && args[1];
+        } else {
+            out.b = args[0] || args[1];
+        }
+        return true;
+    }
+    
+    static bool fold_call(const ast_function_call* expr, fold_state& st, fold_value& out) {
+        if(fold_logic_builtin(expr, st, out)) {
+            return true;
+        }
+        
+        auto pFunc = st.ctx.module.getFunction(expr->name->name);
+        if(!pFunc || !pFunc->isDeclaration() || pFunc->arg_size() != expr->args.size()) {
+            return false;
+        }
+        auto it = st.ctx.func_is_pure.find(pFunc);
+        if(it == st.ctx.func_is_pure.end() || !it->second) {
+            return false;
+        }
+        
+        std::vector<double> args;
+        for(auto& arg : expr->args) {
+            fold_value v;
+            if(!get_value(arg.get(), v) || v.kind == fold_value::boolean) {
+                return false;
+            }
+            args.push_back(as_real(v));
+        }
+        
+        out.kind = fold_value::real;
+        return eval_math(expr->name->name, args, out.r);
+    }
+    
+    // Converts a value to the declared type of the local it is stored in
+    static bool convert_to_decl(const std::string& type_name, fold_value& v) {
+        if(type_name == "real") {
+            if(v.kind == fold_value::integer) {
+                v.r = (double)v.i;
+                v.kind = fold_value::real;
+            }
+            return v.kind == fold_value::real;
+        } else if(type_name == "int") {
+            return v.kind == fold_value::integer;
+        } else if(type_name == "bool") {
+            return v.kind == fold_value::boolean;
+        }
+        return false;
+    }
+    
+    static void fold_expr(up<ast_expression>& expr, fold_state& st) {
+        if(!expr) {
+            return;
+        }
+        
+        if(auto pId = dynamic_cast<ast_identifier*>(expr.get())) {
+            auto it = st.constants.find(pId->name);
+            if(it != st.constants.end()) {
+                expr = make_literal(it->second, pId);
+            }
+        } else if(auto pDecl = dynamic_cast<ast_declaration*>(expr.get())) {
+            if(pDecl->type) {
+                st.decl_types[pDecl->identifier->name] = pDecl->type->get_type_name();
+            }
+            // A local shadowing a module level constant
+            st.constants.erase(pDecl->identifier->name);
+        } else if(auto pArrayLit = dynamic_cast<ast_array_literal*>(expr.get())) {
+            for(auto& elem : pArrayLit->elements) {
+                fold_expr(elem, st);
+            }
+        } else if(auto pBin = dynamic_cast<ast_binary_op*>(expr.get())) {
+            if(pBin->op == '=') {
+                fold_expr(pBin->rhs, st);
+                if(dynamic_cast<ast_declaration*>(pBin->lhs.get())) {
+                    fold_expr(pBin->lhs, st);
+                }
+                auto pszName = assigned_name(pBin);
+                fold_value v;
+                if(pszName && st.depth == 0 && st.assignments[pszName] == 1 && get_value(pBin->rhs.get(), v)) {
+                    if(convert_to_decl(st.decl_types[pszName], v)) {
+                        st.constants[pszName] = v;
+                    }
+                }
+                return;
+            }
+            
+            fold_expr(pBin->lhs, st);
+            fold_expr(pBin->rhs, st);
+            if(pBin->op == '&' || pBin->op == '|') {
+                fold_logical(expr);
+                return;
+            }
+            
+            fold_value l, r, res;
+            if(get_value(pBin->lhs.get(), l) && get_value(pBin->rhs.get(), r)) {
+                if(fold_binary_op(pBin, l, r, res)) {
+                    expr = make_literal(res, pBin);
+                }
+            }
+        } else if(auto pUn = dynamic_cast<ast_unary_op*>(expr.get())) {
+            fold_expr(pUn->operand, st);
+            fold_value v;
+            if(pUn->op == '!' && get_value(pUn->operand.get(), v) && v.kind == fold_value::boolean) {
+                v.b = !v.b;
+                expr = make_literal(v, pUn);
+            }
+        } else if(auto pCall = dynamic_cast<ast_function_call*>(expr.get())) {
+            for(auto& arg : pCall->args) {
+                fold_expr(arg, st);
+            }
+            fold_value res;
+            if(fold_call(pCall, st, res)) {
+                expr = make_literal(res, pCall);
+            }
+        } else if(auto pBranch = dynamic_cast<ast_branching*>(expr.get())) {
+            fold_expr(pBranch->condition, st);
+            st.depth++;
+            fold_expr(pBranch->line, st);
+            st.depth--;
+            
+            fold_value v;
+            if(get_value(pBranch->condition.get(), v) && v.kind == fold_value::boolean) {
+                if(v.b) {
+                    expr = std::move(pBranch->line);
+                } else {
+                    expr = std::make_unique<ast_empty>();
+                }
+            } else if(pBranch->line && pBranch->line->is_empty()) {
+                // Nothing left to do in the branch, but the condition may have side effects
+                expr = std::move(pBranch->condition);
+            }
+        } else if(auto pWhile = dynamic_cast<ast_while*>(expr.get())) {
+            fold_expr(pWhile->condition, st);
+            st.depth++;
+            for(auto& line : pWhile->body) {
+                fold_expr(line, st);
+            }
+            st.depth--;
+            
+            fold_value v;
+            if(get_value(pWhile->condition.get(), v) && v.kind == fold_value::boolean && !v.b) {
+                expr = std::make_unique<ast_empty>();
+            }
+        } else if(auto pFor = dynamic_cast<ast_for*>(expr.get())) {
+            fold_expr(pFor->from, st);
+            fold_expr(pFor->to, st);
+            st.depth++;
+            for(auto& line : pFor->body) {
+                fold_expr(line, st);
+            }
+            st.depth--;
+            
+            fold_value from, to;
+            if(get_value(pFor->from.get(), from) && get_value(pFor->to.get(), to)) {
+                if(from.kind == fold_value::integer && to.kind == fold_value::integer && from.i >= to.i) {
+                    expr = std::make_unique<ast_empty>();
+                }
+            }
+        }
+    }
+    
+    static void count_assignments(up<ast_expression>& expr, fold_state& st) {
+        if(!expr) {
+            return;
+        }
+        if(auto pBin = dynamic_cast<ast_binary_op*>(expr.get())) {
+            auto pszName = assigned_name(pBin);
+            if(pszName) {
+                st.assignments[pszName]++;
+            }
+        } else if(auto pFor = dynamic_cast<ast_for*>(expr.get())) {
+            // The induction variable is assigned on every iteration
+            st.assignments[pFor->var.identifier->name] += 2;
+        }
+        expr->for_each_child([&](up<ast_expression>& child) {
+            count_assignments(child, st);
+        });
+    }
+    
+    static bool is_return(const ast_expression* expr) {
+        auto pCall = dynamic_cast<const ast_function_call*>(expr);
+        return pCall && strcmp(pCall->name->name, "return") == 0;
+    }
+    
+    // Module level scalar constants, unless a local or an argument of the
+    // same name is assigned to. Literals are reals and ints, so f32 and the
+    // narrower ints are left alone; folding them would widen the arithmetic
+    static void add_global_constants(fold_state& st) {
+        for(auto& global : st.ctx.globals) {
+            auto pInit = global.second->getInitializer();
+            fold_value v;
+            auto pFP = llvm::dyn_cast<llvm::ConstantFP>(pInit);
+            auto pInt = llvm::dyn_cast<llvm::ConstantInt>(pInit);
+            if(pFP && pFP->getType()->isDoubleTy()) {
+                v.kind = fold_value::real;
+                v.r = pFP->getValueAPF().convertToDouble();
+            } else if(pInt && pInt->getBitWidth() == 1) {
+                v.kind = fold_value::boolean;
+                v.b = pInt->isOne();
+            } else if(pInt && pInt->getBitWidth() == 64) {
+                v.kind = fold_value::integer;
+                v.i = pInt->getSExtValue();
+            } else {
+                continue;
+            }
+            if(st.assignments[global.first] == 0) {
+                st.constants[global.first] = v;
+            }
+        }
+    }
+    
+    static void fold_function(ast_function* func, llvm_ctx& ctx) {
+        fold_state st(ctx);
+        
+        // Arguments are assigned on entry
+        for(auto& arg : func->prototype->args) {
+            st.assignments[arg.identifier->name]++;
+        }
+        for(auto& line : func->lines) {
+            count_assignments(line, st);
+        }
+        add_global_constants(st);
+        
+        for(auto& line : func->lines) {
+            fold_expr(line, st);
+        }
+        
+        // Remove the branches that were folded away and anything after a return
+        std::vector<up<ast_expression>> lines;
+        for(auto& line : func->lines) {
+            if(line && line->is_empty()) {
+                continue;
+            }
+            bool ret = is_return(line.get());
+            lines.push_back(std::move(line));
+            if(ret) {
+                break;
+            }
+        }
+        func->lines = std::move(lines);
+    }
+    
+    void fold_constants(up<ast_expression>& expr, llvm_ctx& ctx) {
+        if(auto pFunc = dynamic_cast<ast_function*>(expr.get())) {
+            fold_function(pFunc, ctx);
+        } else if(auto pConst = dynamic_cast<ast_const*>(expr.get())) {
+            // Constants can be made of the ones before them
+            fold_state st(ctx);
+            add_global_constants(st);
+            fold_expr(pConst->value, st);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "ast.h"
+
+// Constant folding and propagation over the AST, run before IR generation
+
+namespace core {
+    void fold_constants(up<ast_expression>& expr, llvm_ctx& ctx);
+}
\ No newline at end of file
@@ -1,8 +1,13 @@
 #include "stdafx.h"
 #include <cstdio>
 #include <cstring>
+#include <climits>
+#include <algorithm>
+#include <unistd.h>
 #include "types.h"
 #include "lexer.h"
+#include "server.h"
+#include "module.h"
 
 namespace core {
     static std::string get_next_token(input_file& f) {
@@ -22,10 +27,37 @@ namespace core {
         }
         
         if(!is_eof(f)) {
+            // String literals keep their quotes, so they can be told apart
+            // from identifiers
+            if(c == '"') {
+                do {
+                    buf[buf_len++] = c;
+                    c = fgetc(f.fd);
+                    f.col++;
+                } while(c != '"' && c != '\n' && !is_eof(f) && buf_len < 4094);
+                if(c == '"') {
+                    buf[buf_len++] = c;
+                    c = ' ';
+                }
+                buf[buf_len] = 0;
+                f.last_char = c;
+                return std::string(buf);
+            }
             if(!isalnum(c) && c != '_' && c != '[' && c != ']') {
                 buf[0] = c;
                 buf[1] = 0;
                 f.last_char = ' ';
+                // '&&' and '||'
+                if(c == '&' || c == '|') {
+                    char n = fgetc(f.fd);
+                    f.col++;
+                    if(n == c) {
+                        buf[1] = n;
+                        buf[2] = 0;
+                    } else {
+                        f.last_char = n;
+                    }
+                }
                 return std::string(buf);
             }
             
@@ -58,7 +90,7 @@ namespace core {
             ret = s == "false" || s == "true";
         }
         if(!ret) {
-            // TODO: check for other types here
+            ret = s.size() >= 2 && s.front() == '"' && s.back() == '"';
         }
         return ret;
     }
@@ -116,13 +148,52 @@ namespace core {
             ret = true;
         } else if(s == ">") {
             ret = true;
+        } else if(s == "&&") {
+            ret = true;
+        } else if(s == "||") {
+            ret = true;
         }
         
         return ret;
     }
     
+    static void add_dep(preprocess_info& info, const char* pszPath) {
+        char real[PATH_MAX];
+        if(realpath(pszPath, real)) {
+            info.deps.push_back(real);
+        }
+    }
+    
+    // Takes lib.corm in place of an included lib.cor, if it's up to date and
+    // has only declarations
+    static bool include_module(const char* pszPath, preprocess_info& info) {
+        auto len = strlen(pszPath);
+        if(!info.use_modules || len < 4 || strcmp(pszPath + len - 4, ".cor") != 0) {
+            return false;
+        }
+        std::string path = std::string(pszPath) + "m";
+        if(access(path.c_str(), F_OK) != 0) {
+            return false;
+        }
+        bool has_definitions;
+        const char* pszError;
+        auto module = open_module(path, has_definitions, pszError);
+        if(!module) {
+            fprintf(stderr, "Warning while preprocessing: not using module '%s', %s\n", path.c_str(), pszError);
+            return false;
+        }
+        if(has_definitions) {
+            return false;
+        }
+        // Were the text to change, the module would be out of date
+        add_dep(info, pszPath);
+        add_dep(info, path.c_str());
+        info.modules.push_back(std::move(module));
+        return true;
+    }
+    
     // TODO: prevent line information corruption
-    FILE* preprocess(FILE* f, FILE* tmp) {
+    FILE* preprocess(FILE* f, preprocess_info& info, FILE* tmp) {
         if(!tmp) {
             tmp = tmpfile();
         }
@@ -144,21 +215,36 @@ namespace core {
                 }
                 cmdbuf[cmdidx] = 0;
                 
-                if(strncmp(cmdbuf, "include", 32) == 0) {
+                bool is_include = strncmp(cmdbuf, "include", 32) == 0;
+                bool is_import = strncmp(cmdbuf, "import", 32) == 0;
+                if(is_include || is_import) {
                     c = fgetc(f);
-                    while(!feof(f) && (c != ' ' && c != '\n')) {
+                    while(!feof(f) && (c != ' ' && c != '\n') && pathidx < 255) {
                         pathbuf[pathidx++] = c;
                         c = fgetc(f);
                     }
                     pathbuf[pathidx] = 0;
-                    
-                    auto fsub = fopen(pathbuf, "r");
+                }
+                
+                if(is_import) {
+                    bool has_definitions;
+                    const char* pszError;
+                    auto module = open_module(pathbuf, has_definitions, pszError);
+                    if(!module) {
+                        fprintf(stderr, "Error while preprocessing: can't import module '%s', %s\n", pathbuf, pszError);
+                        return nullptr;
+                    }
+                    add_dep(info, pathbuf);
+                    info.modules.push_back(std::move(module));
+                } else if(is_include && !include_module(pathbuf, info)) {
+                    auto fsub = info.pCache ? info.pCache->open(pathbuf) : fopen(pathbuf, "r");
                     if(!fsub) {
                         fprintf(stderr, "Error while preprocessing: failed to open included file '%s'\n", pathbuf);
                         return nullptr;
                     }
+                    add_dep(info, pathbuf);
                     
-                    preprocess(fsub, tmp);
+                    preprocess(fsub, info, tmp);
                     
                     fclose(fsub);
                 }
@@ -176,6 +262,52 @@ namespace core {
         return tmp;
     }
     
+    // Follows the #include and #import lines only, without preprocessing
+    bool scan_includes(const char* pszPath, preprocess_info& info) {
+        char real[PATH_MAX];
+        if(!realpath(pszPath, real)) {
+            fprintf(stderr, "Error while scanning: failed to open included file '%s'\n", pszPath);
+            return false;
+        }
+        // Included already
+        if(std::find(info.deps.begin(), info.deps.end(), real) != info.deps.end()) {
+            return true;
+        }
+        auto f = fopen(real, "r");
+        if(!f) {
+            fprintf(stderr, "Error while scanning: failed to open included file '%s'\n", pszPath);
+            return false;
+        }
+        info.deps.push_back(real);
+        
+        bool ret = true;
+        char line[1024];
+        char cmd[32];
+        char path[256];
+        while(ret && fgets(line, sizeof(line), f)) {
+            auto pszHash = strchr(line, '#');
+            if(!pszHash || pszHash[1] == ' ' || sscanf(pszHash + 1, "%31s %255s", cmd, path) != 2) {
+                continue;
+            }
+            if(strcmp(cmd, "import") == 0) {
+                if(access(path, F_OK) != 0) {
+                    fprintf(stderr, "Error while scanning: can't import module '%s'\n", path);
+                    ret = false;
+                }
+                add_dep(info, path);
+            } else if(strcmp(cmd, "include") == 0) {
+                // The module that might stand in for the file
+                auto len = strlen(path);
+                if(len >= 4 && strcmp(path + len - 4, ".cor") == 0 && access((std::string(path) + "m").c_str(), F_OK) == 0) {
+                    add_dep(info, (std::string(path) + "m").c_str());
+                }
+                ret = scan_includes(path, info);
+            }
+        }
+        fclose(f);
+        return ret;
+    }
+    
     token get_token(input_file& f) {
         auto s = get_next_token(f);
         if(s == "fn") {
@@ -204,6 +336,16 @@ namespace core {
             return {tok_t::type, s};
         } else if(s == "from") {
             return {tok_t::from, s};
+        } else if(s == "to") {
+            return {tok_t::to, s};
+        } else if(s == "while") {
+            return {tok_t::cwhile, s};
+        } else if(s == "for") {
+            return {tok_t::cfor, s};
+        } else if(s == "parallel") {
+            return {tok_t::parallel, s};
+        } else if(s == "const") {
+            return {tok_t::cconst, s};
         } else {
             if(is_literal(s)) {
                 return {tok_t::literal, s};
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <memory>
 #include "types.h"
 
 namespace core {
@@ -17,7 +18,7 @@ namespace core {
         
         // keywords
         fn, ext, cif, cthen, pure, type,
-        from,
+        from, to, cwhile, cfor, parallel, cconst,
         
         paren_open, paren_close,
         semicolon,
@@ -34,8 +35,24 @@ namespace core {
         int col;
     };
     
+    struct include_cache;
+    
+    // What preprocessing reads besides the source
+    struct preprocess_info {
+        // Included files are read through the cache, if there's one
+        include_cache* pCache = nullptr;
+        // Read an included .cor file's .corm instead, if it can stand in
+        bool use_modules = true;
+        // Real paths of the files read
+        std::vector<std::string> deps;
+        // Modules to load before parsing, in the order they were imported
+        std::vector<std::unique_ptr<llvm::MemoryBuffer>> modules;
+    };
+    
     token get_token(input_file& f);
-    FILE* preprocess(FILE* f, FILE* tmp = nullptr);
+    FILE* preprocess(FILE* f, preprocess_info& info, FILE* tmp = nullptr);
+    // Only finds the files a source depends on; info.deps has the source too
+    bool scan_includes(const char* pszPath, preprocess_info& info);
     
     struct token_stream {
         tok_t type() const {
@@ -62,6 +79,11 @@ namespace core {
             return c.front().col;
         }
         
+        // Type of the token after the current one
+        tok_t next_type() const {
+            return c.size() > 1 ? std::next(c.begin())->first : tok_t::invalid;
+        }
+        
         void add_tokens(std::list<token>& other) {
             c.splice(c.end(), other);
         }
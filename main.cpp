@@ -2,17 +2,169 @@
 
 #include "lexer.h"
 #include "parser.h"
+#include "fold.h"
+#include "profile.h"
+#include "server.h"
+#include "module.h"
+
+#include <algorithm>
+#include <unistd.h>
 
 struct cpu_feature_request {
     bool vector = false;
+    // Target the CPU corec is running on instead of a generic one
+    bool native = false;
 };
 
-core::token_stream tokenize(const char* pszSource) {
-    core::token_stream ts;
+struct optimization_request {
+    unsigned level = 0;
+    // Vector math library the vectorizer may call; SVML, Accelerate or libmvec
+    const char* veclib = nullptr;
+    // Bitcode of the runtime to link into the module; empty if none
+    std::string runtime_bc;
+    // Keep frame pointers, which the sampling profiler unwinds with
+    bool keep_frame_pointers = false;
+    // Only Main and the exports are called from outside the module
+    bool whole_program = false;
+    std::vector<std::string> exports;
+    // Relaxed floating point semantics for reals, from -ffast-math and the
+    // finer flags
+    llvm::FastMathFlags fast_math;
+};
+
+// Everything the command line asks of a compile
+struct compile_request {
+    const char* pszSource = nullptr;
+    const char* pszDest = nullptr;
+    cpu_feature_request feat_req;
+    optimization_request opt_req;
+    bool dump_ir = false;
+    // Write the interface of the source to a module instead of an object
+    bool emit_module = false;
+    // Make rules for the files the output depends on; -MD writes them along
+    // with the output, -MM instead of it
+    bool write_deps = false;
+    bool deps_only = false;
+    // Empty rules for every dependency, as -MP
+    bool phony_deps = false;
+    const char* pszDepFile = nullptr;
+    // Where an instrumented program writes its profile, if instrumenting
+    const char* pszProfileGenerate = nullptr;
+    const char* pszProfileUse = nullptr;
+    bool instrument_functions = false;
+    core::debug_info_level debug_info = core::debug_info_level::none;
+    // Optimization remarks to report, by regexes of the pass names, as
+    // -Rpass, -Rpass-missed and -Rpass-analysis
+    const char* pszRemarksPassed = nullptr;
+    const char* pszRemarksMissed = nullptr;
+    const char* pszRemarksAnalysis = nullptr;
+    // Every remark is written to this YAML file, if it's set
+    std::string remarks_file;
+    bool save_remarks = false;
+};
+
+// Reports the optimization remarks the passes asked for at their locations
+// in the source, the way the front end reports its warnings
+struct remark_handler : public llvm::DiagnosticHandler {
+    remark_handler(const compile_request& req) {
+        if(req.pszRemarksPassed) {
+            passed = std::make_unique<llvm::Regex>(req.pszRemarksPassed);
+        }
+        if(req.pszRemarksMissed) {
+            missed = std::make_unique<llvm::Regex>(req.pszRemarksMissed);
+        }
+        if(req.pszRemarksAnalysis) {
+            analysis = std::make_unique<llvm::Regex>(req.pszRemarksAnalysis);
+        }
+    }
+    
+    bool isPassedOptRemarkEnabled(llvm::StringRef pass_name) const override {
+        return passed && passed->match(pass_name);
+    }
+    
+    bool isMissedOptRemarkEnabled(llvm::StringRef pass_name) const override {
+        return missed && missed->match(pass_name);
+    }
+    
+    bool isAnalysisRemarkEnabled(llvm::StringRef pass_name) const override {
+        return analysis && analysis->match(pass_name);
+    }
+    
+    bool handleDiagnostics(const llvm::DiagnosticInfo& di) override {
+        auto pRemark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&di);
+        // Anything else is left to LLVM
+        if(!pRemark) {
+            return false;
+        }
+        if(!pRemark->isEnabled()) {
+            return true;
+        }
+        
+        const char* pszOption = nullptr;
+        switch(di.getKind()) {
+            case llvm::DK_OptimizationRemark:
+            case llvm::DK_MachineOptimizationRemark:
+                pszOption = "-Rpass";
+                break;
+            case llvm::DK_OptimizationRemarkMissed:
+            case llvm::DK_MachineOptimizationRemarkMissed:
+                pszOption = "-Rpass-missed";
+                break;
+            case llvm::DK_OptimizationRemarkAnalysis:
+            case llvm::DK_OptimizationRemarkAnalysisFPCommute:
+            case llvm::DK_OptimizationRemarkAnalysisAliasing:
+            case llvm::DK_MachineOptimizationRemarkAnalysis:
+                pszOption = "-Rpass-analysis";
+                break;
+            default:
+                break;
+        }
+        
+        if(di.getSeverity() == llvm::DS_Error) {
+            fprintf(stderr, "\033[91mError\033[0m ");
+        } else if(di.getSeverity() == llvm::DS_Warning) {
+            fprintf(stderr, "\033[93mWarning\033[0m ");
+        } else {
+            fprintf(stderr, "\033[96mRemark\033[0m ");
+        }
+        // Locations are the front end's, which start at 0
+        if(pRemark->isLocationAvailable()) {
+            auto loc = pRemark->getLocation();
+            fprintf(stderr, "[%u:%u]: ", loc.getLine() + 1, loc.getColumn() + 1);
+        } else {
+            fprintf(stderr, "[%s]: ", pRemark->getFunction().getName().str().c_str());
+        }
+        fprintf(stderr, "%s", pRemark->getMsg().c_str());
+        if(pszOption) {
+            fprintf(stderr, " [%s=%s]", pszOption, pRemark->getPassName().str().c_str());
+        }
+        fprintf(stderr, "\n");
+        return true;
+    }
+    
+    std::unique_ptr<llvm::Regex> passed;
+    std::unique_ptr<llvm::Regex> missed;
+    std::unique_ptr<llvm::Regex> analysis;
+};
+
+bool tokenize(core::token_stream& ts, const char* pszSource, core::preprocess_info& info) {
     input_file f(pszSource);
     core::token t;
     
-    auto new_fd = core::preprocess(f.fd);
+    if(!f.fd) {
+        fprintf(stderr, "Couldn't open source file '%s'\n", pszSource);
+        return false;
+    }
+    
+    llvm::SmallString<256> real;
+    if(!llvm::sys::fs::real_path(pszSource, real)) {
+        info.deps.push_back(real.str().str());
+    }
+    
+    auto new_fd = core::preprocess(f.fd, info);
+    if(!new_fd) {
+        return false;
+    }
     fclose(f.fd);
     fseek(new_fd, 0, SEEK_SET);
     f.fd = new_fd;
@@ -26,45 +178,310 @@ core::token_stream tokenize(const char* pszSource) {
         }
     }
     
-    return ts;
+    return true;
 }
 
-bool codegen(core::llvm_ctx& ctx, const char* pszDest, core::token_stream& ts, bool dump_ir, core::type_manager& type_mgr) {
-    bool ret = true;
-    while(!ts.empty() && ret) {
+static const char* function_name(core::ast_expression* expr) {
+    auto pFunc = dynamic_cast<core::ast_function*>(expr);
+    if(!pFunc) {
+        return nullptr;
+    }
+    return ((core::ast_identifier*)pFunc->prototype->name.get())->name;
+}
+
+static void collect_calls(core::up<core::ast_expression>& expr, std::vector<const char*>& calls) {
+    if(!expr) {
+        return;
+    }
+    if(auto pCall = dynamic_cast<core::ast_function_call*>(expr.get())) {
+        calls.push_back(pCall->name->name);
+        // pmap(f, src, dst) calls f, which it takes by name
+        auto pFn = pCall->args.empty() ? nullptr : dynamic_cast<core::ast_identifier*>(pCall->args[0].get());
+        if(pFn && strcmp(pCall->name->name, "pmap") == 0) {
+            calls.push_back(pFn->name);
+        }
+    }
+    expr->for_each_child([&](core::up<core::ast_expression>& child) {
+        collect_calls(child, calls);
+    });
+}
+
+// Marks the functions reachable from the roots through calls; the rest
+// don't need to be generated
+static std::vector<bool> find_reachable(std::vector<core::up<core::ast_expression>>& exprs, const std::vector<std::string>& roots) {
+    std::unordered_map<std::string, size_t> functions;
+    for(size_t i = 0; i < exprs.size(); i++) {
+        auto pszName = function_name(exprs[i].get());
+        if(pszName) {
+            functions[pszName] = i;
+        }
+    }
+    
+    std::vector<bool> reachable(exprs.size(), false);
+    std::vector<size_t> work;
+    auto visit = [&](const char* pszName) {
+        auto it = functions.find(pszName);
+        if(it != functions.end() && !reachable[it->second]) {
+            reachable[it->second] = true;
+            work.push_back(it->second);
+        }
+    };
+    for(auto& root : roots) {
+        visit(root.c_str());
+    }
+    while(!work.empty()) {
+        auto i = work.back();
+        work.pop_back();
+        std::vector<const char*> calls;
+        collect_calls(exprs[i], calls);
+        for(auto pszCallee : calls) {
+            visit(pszCallee);
+        }
+    }
+    return reachable;
+}
+
+bool parse_all(core::llvm_ctx& ctx, core::token_stream& ts, core::type_manager& type_mgr, std::vector<core::up<core::ast_expression>>& exprs) {
+    while(!ts.empty()) {
         auto expr = core::parse(ts, ctx, type_mgr);
-        if(expr && dump_ir) {
+        if(!expr) {
+            return false;
+        }
+        exprs.push_back(std::move(expr));
+    }
+    return true;
+}
+
+// With roots, only the functions reachable from them are generated;
+// declarations and types always are
+bool codegen(core::llvm_ctx& ctx, std::vector<core::up<core::ast_expression>>& exprs, bool dump_ir, const std::vector<std::string>* pRoots) {
+    bool ret = true;
+    std::vector<bool> reachable;
+    int skipped = 0;
+    if(pRoots) {
+        reachable = find_reachable(exprs, *pRoots);
+    }
+    
+    for(size_t i = 0; i < exprs.size() && ret; i++) {
+        auto& expr = exprs[i];
+        if(pRoots && !reachable[i] && function_name(expr.get())) {
+            skipped++;
+            continue;
+        }
+        // Folding looks at the declarations generated before
+        core::fold_constants(expr, ctx);
+        if(dump_ir) {
             expr->dump();
         }
-        if(expr) {
-            if(!expr->is_empty()) {
-                auto ir = expr->generate_ir(ctx);
-                if(ir) {
-                    
-                } else {
-                    ret = false;
-                }
+        if(!expr->is_empty()) {
+            auto ir = expr->generate_ir(ctx);
+            if(ir) {
+                
+            } else {
+                ret = false;
             }
-        } else {
-            ret = false;
         }
     }
+    if(skipped > 0) {
+        fprintf(stderr, "Skipped %d function(s) not reachable from Main or the exports\n", skipped);
+    }
+    if(ret) {
+        core::finish_profile(ctx);
+    }
     ctx.dbuilder.finalize();
     return ret;
 }
 
-bool emit_object(core::llvm_ctx& ctx, const char* pszDest, const cpu_feature_request& feat_req) {
+// Vector variants of glibc's libm, as named by the x86_64 vector function ABI
+static const llvm::VecDesc libmvec_sse[] = {
+    {"sin", "_ZGVbN2v_sin", 2},
+    {"llvm.sin.f64", "_ZGVbN2v_sin", 2},
+    {"cos", "_ZGVbN2v_cos", 2},
+    {"llvm.cos.f64", "_ZGVbN2v_cos", 2},
+    {"exp", "_ZGVbN2v_exp", 2},
+    {"llvm.exp.f64", "_ZGVbN2v_exp", 2},
+    {"log", "_ZGVbN2v_log", 2},
+    {"llvm.log.f64", "_ZGVbN2v_log", 2},
+    {"pow", "_ZGVbN2vv_pow", 2},
+    {"llvm.pow.f64", "_ZGVbN2vv_pow", 2},
+};
+
+static const llvm::VecDesc libmvec_avx2[] = {
+    {"sin", "_ZGVdN4v_sin", 4},
+    {"llvm.sin.f64", "_ZGVdN4v_sin", 4},
+    {"cos", "_ZGVdN4v_cos", 4},
+    {"llvm.cos.f64", "_ZGVdN4v_cos", 4},
+    {"exp", "_ZGVdN4v_exp", 4},
+    {"llvm.exp.f64", "_ZGVdN4v_exp", 4},
+    {"log", "_ZGVdN4v_log", 4},
+    {"llvm.log.f64", "_ZGVdN4v_log", 4},
+    {"pow", "_ZGVdN4vv_pow", 4},
+    {"llvm.pow.f64", "_ZGVdN4vv_pow", 4},
+};
+
+static bool add_vector_library(llvm::TargetLibraryInfoImpl& tlii, llvm::TargetMachine* target_machine, const char* pszLib) {
+    if(strcmp(pszLib, "SVML") == 0) {
+        tlii.addVectorizableFunctionsFromVecLib(llvm::TargetLibraryInfoImpl::SVML);
+    } else if(strcmp(pszLib, "Accelerate") == 0) {
+        tlii.addVectorizableFunctionsFromVecLib(llvm::TargetLibraryInfoImpl::Accelerate);
+    } else if(strcmp(pszLib, "libmvec") == 0) {
+        tlii.addVectorizableFunctions(libmvec_sse);
+        // The 4 wide variants need AVX2
+        if(target_machine->getTargetFeatureString().find("+avx2") != llvm::StringRef::npos) {
+            tlii.addVectorizableFunctions(libmvec_avx2);
+        }
+    } else {
+        fprintf(stderr, "Unknown vector library '%s'\n", pszLib);
+        return false;
+    }
+    return true;
+}
+
+// Links in the definitions of the runtime functions the module uses, so
+// they can be inlined into cor code
+bool link_runtime(core::llvm_ctx& ctx, const std::string& path) {
+    llvm::SMDiagnostic diag;
+    auto runtime = llvm::parseIRFile(path, diag, ctx.ctx);
+    if(!runtime) {
+        diag.print("corec", llvm::errs());
+        return false;
+    }
+    runtime->setDataLayout(ctx.module.getDataLayout());
+    runtime->setTargetTriple(ctx.module.getTargetTriple());
+    // clang's CPU and features would keep the runtime from being inlined
+    // into cor functions, which have none and get those of the target
+    // machine; the runtime gets them too
+    for(auto& func : *runtime) {
+        func.removeFnAttr("target-cpu");
+        func.removeFnAttr("target-features");
+    }
+    
+    // Only what's still referenced gets linked in
+    for(auto it = ctx.module.begin(); it != ctx.module.end();) {
+        auto& func = *it++;
+        if(func.isDeclaration() && func.use_empty()) {
+            func.eraseFromParent();
+        }
+    }
+    
+    auto internalize = [](llvm::Module& module, const llvm::StringSet<>& linked) {
+        for(auto& entry : linked) {
+            auto pGV = module.getNamedValue(entry.getKey());
+            if(!pGV || pGV->isDeclaration()) {
+                continue;
+            }
+            auto pVar = llvm::dyn_cast<llvm::GlobalVariable>(pGV);
+            if(pVar && !pVar->isConstant()) {
+                // Runtime state stays shared with the one in corert.o
+                pVar->setInitializer(nullptr);
+                pVar->setLinkage(llvm::GlobalValue::ExternalLinkage);
+            } else {
+                pGV->setLinkage(llvm::GlobalValue::InternalLinkage);
+            }
+        }
+    };
+    
+    if(llvm::Linker::linkModules(ctx.module, std::move(runtime), llvm::Linker::Flags::LinkOnlyNeeded, internalize)) {
+        fprintf(stderr, "Failed to link the runtime bitcode '%s'\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Makes everything but Main and the exports internal, so the optimizer
+// is free to inline, specialize and drop it, and change its calling
+// convention
+void internalize(core::llvm_ctx& ctx, const optimization_request& opt_req) {
+    llvm::StringSet<> preserved;
+    preserved.insert("Main");
+    for(auto& name : opt_req.exports) {
+        preserved.insert(name);
+    }
+    
+    bool any_preserved = false;
+    for(auto& entry : preserved) {
+        auto pFunc = ctx.module.getFunction(entry.getKey());
+        any_preserved |= pFunc && !pFunc->isDeclaration();
+    }
+    if(!any_preserved) {
+        fprintf(stderr, "-fwhole-program: neither Main nor an export is defined, nothing will be left\n");
+    }
+    
+    llvm::internalizeModule(ctx.module, [&](const llvm::GlobalValue& gv) {
+        return preserved.count(gv.getName()) != 0;
+    });
+    
+    for(auto& func : ctx.module) {
+        if(func.isDeclaration() || !func.hasLocalLinkage() || func.hasAddressTaken()) {
+            continue;
+        }
+        func.setCallingConv(llvm::CallingConv::Fast);
+        for(auto pUser : func.users()) {
+            if(auto pCall = llvm::dyn_cast<llvm::CallInst>(pUser)) {
+                pCall->setCallingConv(llvm::CallingConv::Fast);
+            }
+        }
+    }
+    
+    // Functions nothing calls anymore and the unused declarations of
+    // runtime.cor are dropped even at -O0
+    llvm::legacy::PassManager pm;
+    pm.add(llvm::createGlobalDCEPass());
+    pm.run(ctx.module);
+    for(auto it = ctx.module.begin(); it != ctx.module.end();) {
+        auto& func = *it++;
+        if(func.isDeclaration() && func.use_empty()) {
+            func.eraseFromParent();
+        }
+    }
+}
+
+bool optimize(core::llvm_ctx& ctx, llvm::TargetMachine* target_machine, const optimization_request& opt_req) {
+    llvm::legacy::FunctionPassManager fpm(&ctx.module);
+    llvm::legacy::PassManager mpm;
+    llvm::PassManagerBuilder builder;
+    
+    auto tlii = new llvm::TargetLibraryInfoImpl(llvm::Triple(ctx.module.getTargetTriple()));
+    builder.LibraryInfo = tlii;
+    if(opt_req.veclib && !add_vector_library(*tlii, target_machine, opt_req.veclib)) {
+        return false;
+    }
+    
+    builder.OptLevel = opt_req.level;
+    builder.SizeLevel = 0;
+    if(opt_req.level > 1) {
+        builder.Inliner = llvm::createFunctionInliningPass(opt_req.level, 0, false);
+    } else {
+        builder.Inliner = llvm::createAlwaysInlinerLegacyPass();
+    }
+    builder.LoopVectorize = opt_req.level > 1;
+    builder.SLPVectorize = opt_req.level > 1;
+    target_machine->adjustPassManager(builder);
+    
+    fpm.add(llvm::createTargetTransformInfoWrapperPass(target_machine->getTargetIRAnalysis()));
+    mpm.add(llvm::createTargetTransformInfoWrapperPass(target_machine->getTargetIRAnalysis()));
+    builder.populateFunctionPassManager(fpm);
+    builder.populateModulePassManager(mpm);
+    
+    fpm.doInitialization();
+    for(auto& func : ctx.module) {
+        fpm.run(func);
+    }
+    fpm.doFinalization();
+    mpm.run(ctx.module);
+    return true;
+}
+
+bool emit_object(core::llvm_ctx& ctx, const char* pszDest, const cpu_feature_request& feat_req, const optimization_request& opt_req) {
     std::string error;
     std::error_code ec;
     llvm::legacy::PassManager pass;
     
     auto target_triple = llvm::sys::getDefaultTargetTriple();
     
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmParsers();
-    llvm::InitializeAllAsmPrinters();
+    // Only ever compiling for the host, so the other backends aren't needed
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
     
     auto target = llvm::TargetRegistry::lookupTarget(target_triple, error);
     
@@ -73,18 +490,62 @@ bool emit_object(core::llvm_ctx& ctx, const char* pszDest, const cpu_feature_req
         return false;
     }
     
-    auto pszCPU = "generic";
-    auto pszFeatures = "";
+    std::string cpu = "generic";
+    std::string features = "";
+    
+    if(feat_req.native) {
+        llvm::StringMap<bool> host_features;
+        cpu = llvm::sys::getHostCPUName();
+        if(llvm::sys::getHostCPUFeatures(host_features)) {
+            for(auto& feature : host_features) {
+                features += (feature.second ? "+" : "-") + feature.first().str() + ",";
+            }
+        }
+    }
     
     llvm::TargetOptions target_opts;
+    // Selects instructions fast at -O0, instead of well; GlobalISel is left
+    // to the targets that enable it at -O0 themselves
+    target_opts.EnableFastISel = opt_req.level == 0;
+    // The rest of the fast math flags go on the functions
+    if(opt_req.fast_math.allowContract()) {
+        target_opts.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+    }
     
     auto rm = llvm::Optional<llvm::Reloc::Model>();
     rm = llvm::Reloc::Model::PIC_;
-    auto target_machine = target->createTargetMachine(target_triple, pszCPU, pszFeatures, target_opts, rm);
+    
+    llvm::CodeGenOpt::Level cg_level;
+    switch(opt_req.level) {
+        case 0: cg_level = llvm::CodeGenOpt::None; break;
+        case 1: cg_level = llvm::CodeGenOpt::Less; break;
+        case 2: cg_level = llvm::CodeGenOpt::Default; break;
+        default: cg_level = llvm::CodeGenOpt::Aggressive; break;
+    }
+    
+    auto target_machine = target->createTargetMachine(target_triple, cpu, features, target_opts, rm, llvm::None, cg_level);
     
     ctx.module.setDataLayout(target_machine->createDataLayout());
     ctx.module.setTargetTriple(target_triple);
     
+    if(!opt_req.runtime_bc.empty() && !link_runtime(ctx, opt_req.runtime_bc)) {
+        return false;
+    }
+    
+    if(opt_req.whole_program) {
+        internalize(ctx, opt_req);
+    }
+    
+    if(opt_req.keep_frame_pointers) {
+        for(auto& func : ctx.module) {
+            func.addFnAttr("no-frame-pointer-elim", "true");
+        }
+    }
+    
+    if(!optimize(ctx, target_machine, opt_req)) {
+        return false;
+    }
+    
     llvm::raw_fd_ostream dest(pszDest, ec, llvm::sys::fs::F_None);
     
     if(ec) {
@@ -102,17 +563,31 @@ bool emit_object(core::llvm_ctx& ctx, const char* pszDest, const cpu_feature_req
     return true;
 }
 
-int main(int argc, char** argv) {
-    const char* pszSource = nullptr;
-    const char* pszDest = nullptr;
-    cpu_feature_request feat_req;
-    bool dump_ir = false;
+// corert.bc is looked for next to corec, unless COREC_RUNTIME_BC says otherwise
+std::string find_runtime_bc(const char* argv0) {
+    auto pszEnv = getenv("COREC_RUNTIME_BC");
+    if(pszEnv) {
+        return pszEnv;
+    }
+    
+    auto exe = llvm::sys::fs::getMainExecutable(argv0, (void*)&find_runtime_bc);
+    llvm::SmallString<256> path(llvm::sys::path::parent_path(exe));
+    llvm::sys::path::append(path, "corert.bc");
+    if(llvm::sys::fs::exists(path)) {
+        return path.str().str();
+    }
+    return "";
+}
+
+// Returns the exit code to stop with, or -1 to go on with the compile
+int parse_command_line(int argc, char** argv, compile_request& req) {
+    bool runtime_bc_given = false;
     
     for(int i = 1; i < argc; i++) {
         if(strcmp(argv[i],  "-c") == 0) {
             if(i + 1 < argc) {
                 if(argv[i + 1][0] != '-') {
-                    pszSource = argv[i + 1];
+                    req.pszSource = argv[i + 1];
                     i++;
                 } else {
                     fprintf(stderr, "Expected source filename after -c\n");
@@ -125,7 +600,7 @@ int main(int argc, char** argv) {
         } else if(strcmp(argv[i], "-o") == 0) {
             if(i + 1 < argc) {
                 if(argv[i + 1][0] != '-') {
-                    pszDest = argv[i + 1];
+                    req.pszDest = argv[i + 1];
                     i++;
                 } else {
                     fprintf(stderr, "Expected destination filename after -o\n");
@@ -135,25 +610,338 @@ int main(int argc, char** argv) {
                 fprintf(stderr, "Expected destination filename after -o\n");
                 return 1;
             }
+        } else if(strcmp(argv[i], "-MD") == 0) {
+            req.write_deps = true;
+        } else if(strcmp(argv[i], "-MM") == 0) {
+            req.deps_only = true;
+        } else if(strcmp(argv[i], "-MP") == 0) {
+            req.phony_deps = true;
+        } else if(strcmp(argv[i], "-MF") == 0) {
+            if(i + 1 < argc) {
+                req.pszDepFile = argv[i + 1];
+                i++;
+            } else {
+                fprintf(stderr, "Expected dependency filename after -MF\n");
+                return 1;
+            }
+        } else if(strcmp(argv[i], "-emit-module") == 0) {
+            req.emit_module = true;
         } else if(strcmp(argv[i], "-D") == 0) {
-            dump_ir = true;
+            req.dump_ir = true;
+        } else if(strcmp(argv[i], "-g") == 0) {
+            req.debug_info = core::debug_info_level::full;
+        } else if(strcmp(argv[i], "-gline-tables-only") == 0) {
+            req.debug_info = core::debug_info_level::line_tables;
+        } else if(strcmp(argv[i], "-g0") == 0) {
+            req.debug_info = core::debug_info_level::none;
+        } else if(strncmp(argv[i], "-Rpass=", 7) == 0) {
+            req.pszRemarksPassed = argv[i] + 7;
+        } else if(strncmp(argv[i], "-Rpass-missed=", 14) == 0) {
+            req.pszRemarksMissed = argv[i] + 14;
+        } else if(strncmp(argv[i], "-Rpass-analysis=", 16) == 0) {
+            req.pszRemarksAnalysis = argv[i] + 16;
+        } else if(strcmp(argv[i], "-fsave-optimization-record") == 0) {
+            req.save_remarks = true;
+        } else if(strncmp(argv[i], "-foptimization-record-file=", 27) == 0) {
+            req.remarks_file = argv[i] + 27;
+            req.save_remarks = true;
+        } else if(strncmp(argv[i], "-O", 2) == 0) {
+            if(argv[i][2] >= '0' && argv[i][2] <= '3' && argv[i][3] == 0) {
+                req.opt_req.level = argv[i][2] - '0';
+            } else {
+                fprintf(stderr, "Unknown optimization level '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if(strcmp(argv[i], "-ffast-math") == 0) {
+            req.opt_req.fast_math.setFast();
+        } else if(strcmp(argv[i], "-fno-fast-math") == 0) {
+            req.opt_req.fast_math.clear();
+        } else if(strcmp(argv[i], "-fno-honor-nans") == 0) {
+            req.opt_req.fast_math.setNoNaNs();
+        } else if(strcmp(argv[i], "-fno-honor-infinities") == 0) {
+            req.opt_req.fast_math.setNoInfs();
+        } else if(strcmp(argv[i], "-fno-signed-zeros") == 0) {
+            req.opt_req.fast_math.setNoSignedZeros();
+        } else if(strcmp(argv[i], "-freciprocal-math") == 0) {
+            req.opt_req.fast_math.setAllowReciprocal();
+        } else if(strcmp(argv[i], "-fassociative-math") == 0) {
+            req.opt_req.fast_math.setAllowReassoc();
+        } else if(strncmp(argv[i], "-ffp-contract=", 14) == 0) {
+            // Fusing a multiply and an add into an FMA
+            if(strcmp(argv[i] + 14, "fast") == 0) {
+                req.opt_req.fast_math.setAllowContract(true);
+            } else if(strcmp(argv[i] + 14, "off") == 0) {
+                req.opt_req.fast_math.setAllowContract(false);
+            } else {
+                fprintf(stderr, "Unknown floating point contraction '%s'; expected fast or off\n", argv[i] + 14);
+                return 1;
+            }
+        } else if(strncmp(argv[i], "-fveclib=", 9) == 0) {
+            req.opt_req.veclib = argv[i] + 9;
+        } else if(strcmp(argv[i], "-march=native") == 0) {
+            req.feat_req.native = true;
+        } else if(strncmp(argv[i], "-fruntime-bc=", 13) == 0) {
+            req.opt_req.runtime_bc = argv[i] + 13;
+            runtime_bc_given = true;
+        } else if(strcmp(argv[i], "-fno-runtime-bc") == 0) {
+            req.opt_req.runtime_bc.clear();
+            runtime_bc_given = true;
+        } else if(strcmp(argv[i], "-fprofile-generate") == 0) {
+            req.pszProfileGenerate = "default.corprof";
+        } else if(strncmp(argv[i], "-fprofile-generate=", 19) == 0) {
+            req.pszProfileGenerate = argv[i] + 19;
+        } else if(strncmp(argv[i], "-fprofile-use=", 14) == 0) {
+            req.pszProfileUse = argv[i] + 14;
+        } else if(strcmp(argv[i], "-fno-omit-frame-pointer") == 0) {
+            req.opt_req.keep_frame_pointers = true;
+        } else if(strcmp(argv[i], "-fomit-frame-pointer") == 0) {
+            req.opt_req.keep_frame_pointers = false;
+        } else if(strcmp(argv[i], "-finstrument-functions") == 0) {
+            req.instrument_functions = true;
+        } else if(strcmp(argv[i], "-fwhole-program") == 0) {
+            req.opt_req.whole_program = true;
+        } else if(strncmp(argv[i], "-fexport=", 9) == 0) {
+            // A comma separated list of functions
+            llvm::SmallVector<llvm::StringRef, 4> names;
+            llvm::StringRef(argv[i] + 9).split(names, ',', -1, false);
+            for(auto name : names) {
+                req.opt_req.exports.push_back(name.str());
+            }
         }
     }
     
-    if(pszSource && pszDest) {
-        core::type_manager type_mgr;
-        auto ts = tokenize(pszSource);
-        core::llvm_ctx ctx(pszSource, pszDest);
-        if(codegen(ctx, pszDest, ts, dump_ir, type_mgr)) {
-            if(emit_object(ctx, pszDest, feat_req)) {
-                return 0;
-            } else {
-                return 4;
+    if(!runtime_bc_given) {
+        req.opt_req.runtime_bc = find_runtime_bc(argv[0]);
+    }
+    
+    if(!req.pszSource || (!req.pszDest && !req.deps_only)) {
+        return 2;
+    }
+    
+    for(auto pszRegex : { req.pszRemarksPassed, req.pszRemarksMissed, req.pszRemarksAnalysis }) {
+        std::string error;
+        if(pszRegex && !llvm::Regex(pszRegex).isValid(error)) {
+            fprintf(stderr, "Invalid regex '%s' for the remarks: %s\n", pszRegex, error.c_str());
+            return 1;
+        }
+    }
+    if(req.save_remarks && req.remarks_file.empty() && req.pszDest) {
+        llvm::SmallString<256> path(req.pszDest);
+        llvm::sys::path::replace_extension(path, "opt.yaml");
+        req.remarks_file = path.str().str();
+    }
+    // Remarks need the locations of the source even without debug info,
+    // though none of it is emitted
+    bool remarks = req.pszRemarksPassed || req.pszRemarksMissed || req.pszRemarksAnalysis || req.save_remarks;
+    if(remarks && req.debug_info == core::debug_info_level::none) {
+        req.debug_info = core::debug_info_level::locations;
+    }
+    return -1;
+}
+
+// Writes a make rule for the output, with every file it was made from
+bool write_dep_file(const compile_request& req, const std::vector<std::string>& deps) {
+    llvm::SmallString<256> target;
+    llvm::SmallString<256> path;
+    if(req.pszDest) {
+        target = req.pszDest;
+    } else {
+        target = llvm::sys::path::filename(req.pszSource);
+        llvm::sys::path::replace_extension(target, "o");
+    }
+    if(req.pszDepFile) {
+        path = req.pszDepFile;
+    } else if(req.deps_only) {
+        path = "-";
+    } else {
+        path = target;
+        llvm::sys::path::replace_extension(path, "d");
+    }
+    
+    std::error_code ec;
+    llvm::raw_fd_ostream out(path, ec, llvm::sys::fs::F_None);
+    if(ec) {
+        fprintf(stderr, "Couldn't open dependency file '%s'\n", path.c_str());
+        return false;
+    }
+    
+    auto escape = [](const std::string& s) {
+        std::string ret;
+        for(auto c : s) {
+            if(c == ' ' || c == '#') {
+                ret += '\\';
+            } else if(c == '$') {
+                ret += '$';
             }
-        } else {
+            ret += c;
+        }
+        return ret;
+    };
+    
+    std::vector<std::string> unique;
+    for(auto& dep : deps) {
+        if(std::find(unique.begin(), unique.end(), dep) == unique.end()) {
+            unique.push_back(dep);
+        }
+    }
+    out << escape(target.str().str()) << ":";
+    for(auto& dep : unique) {
+        out << " \\\n  " << escape(dep);
+    }
+    out << "\n";
+    // Keeps make going when an included file is removed
+    if(req.phony_deps) {
+        for(size_t i = 1; i < unique.size(); i++) {
+            out << "\n" << escape(unique[i]) << ":\n";
+        }
+    }
+    return true;
+}
+
+// Every remark goes to the record, whether it's reported or not
+bool open_remarks_file(core::llvm_ctx& ctx, const compile_request& req, std::unique_ptr<llvm::ToolOutputFile>& file) {
+    std::error_code ec;
+    file = std::make_unique<llvm::ToolOutputFile>(req.remarks_file, ec, llvm::sys::fs::F_None);
+    if(ec) {
+        fprintf(stderr, "Couldn't open optimization record file '%s'\n", req.remarks_file.c_str());
+        return false;
+    }
+    ctx.ctx.setDiagnosticsOutputFile(std::make_unique<llvm::yaml::Output>(file->os()));
+    // How hot the code of a remark is, with a profile to go by
+    ctx.ctx.setDiagnosticsHotnessRequested(req.pszProfileUse != nullptr);
+    return true;
+}
+
+// -MM only follows the #include lines
+int scan_deps(const compile_request& req, core::preprocess_info& info) {
+    if(!core::scan_includes(req.pszSource, info)) {
+        return 3;
+    }
+    return write_dep_file(req, info.deps) ? 0 : 4;
+}
+
+int compile(const compile_request& req, core::token_stream& ts, core::preprocess_info& info) {
+    core::type_manager type_mgr;
+    // Outlives the context, which writes to it
+    std::unique_ptr<llvm::ToolOutputFile> remarks_file;
+    core::llvm_ctx ctx(req.pszSource, req.pszDest, req.debug_info);
+    // Names of values are only worth keeping when the IR gets looked at
+    ctx.ctx.setDiscardValueNames(!req.dump_ir);
+    ctx.ctx.setDiagnosticHandler(std::make_unique<remark_handler>(req));
+    if(!req.remarks_file.empty() && !open_remarks_file(ctx, req, remarks_file)) {
+        return 1;
+    }
+    ctx.instrument_functions = req.instrument_functions;
+    ctx.fast_math = req.opt_req.fast_math;
+    if(req.pszProfileGenerate) {
+        ctx.profile_generate = true;
+        ctx.profile_path = req.pszProfileGenerate;
+    } else if(req.pszProfileUse && !core::read_profile(ctx, req.pszProfileUse)) {
+        return 1;
+    }
+    
+    for(auto& module : info.modules) {
+        if(!core::load_module(ctx, type_mgr, *module)) {
             return 3;
         }
+    }
+    std::vector<core::up<core::ast_expression>> exprs;
+    if(!parse_all(ctx, ts, type_mgr, exprs)) {
+        return 3;
+    }
+    if(req.emit_module) {
+        if(!core::write_module(req.pszDest, exprs, type_mgr, info.deps)) {
+            return 4;
+        }
+        return req.write_deps && !write_dep_file(req, info.deps) ? 4 : 0;
+    }
+    
+    // With the whole program in view, what Main and the exports don't
+    // call isn't generated at all
+    std::vector<std::string> roots;
+    if(req.opt_req.whole_program) {
+        roots = req.opt_req.exports;
+        roots.push_back("Main");
+    }
+    if(codegen(ctx, exprs, req.dump_ir, req.opt_req.whole_program ? &roots : nullptr)) {
+        if(emit_object(ctx, req.pszDest, req.feat_req, req.opt_req)) {
+            if(remarks_file) {
+                remarks_file->keep();
+            }
+            return req.write_deps && !write_dep_file(req, info.deps) ? 4 : 0;
+        } else {
+            return 4;
+        }
     } else {
-        return 2;
+        return 3;
+    }
+}
+
+// Reading the command line and the sources is quick, and done by the server
+// itself, so the include cache stays warm; the rest of each compile is left
+// to a child
+int serve(const char* pszSocket) {
+    auto path = pszSocket ? std::string(pszSocket) : core::default_server_socket();
+    auto listen_fd = core::server_listen(path.c_str());
+    if(listen_fd < 0) {
+        return 1;
+    }
+    
+    // Inherited by every child
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    
+    core::include_cache cache;
+    core::server_request req;
+    while(core::server_accept(listen_fd, cache, req)) {
+        std::vector<char*> args;
+        for(auto& arg : req.args) {
+            args.push_back(&arg[0]);
+        }
+        
+        compile_request creq;
+        core::token_stream ts;
+        core::preprocess_info info;
+        info.pCache = &cache;
+        auto ret = parse_command_line(args.size(), args.data(), creq);
+        info.use_modules = !creq.emit_module;
+        if(ret < 0 && creq.deps_only) {
+            ret = scan_deps(creq, info);
+        } else if(ret < 0 && !tokenize(ts, creq.pszSource, info)) {
+            ret = 3;
+        }
+        if(ret >= 0) {
+            core::server_reply(req, ret);
+        } else if(core::server_fork(req)) {
+            core::server_reply(req, compile(creq, ts, info));
+            _exit(0);
+        }
+    }
+    
+    close(listen_fd);
+    unlink(path.c_str());
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1 && strcmp(argv[1], "--server") == 0) {
+        return serve(argc > 2 ? argv[2] : nullptr);
+    }
+    
+    compile_request req;
+    core::token_stream ts;
+    core::preprocess_info info;
+    auto ret = parse_command_line(argc, argv, req);
+    if(ret >= 0) {
+        return ret;
+    }
+    if(req.deps_only) {
+        return scan_deps(req, info);
+    }
+    // A module is made from the text of what its source includes
+    info.use_modules = !req.emit_module;
+    if(!tokenize(ts, req.pszSource, info)) {
+        return 3;
     }
+    return compile(req, ts, info);
 }
\ No newline at end of file
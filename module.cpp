@@ -0,0 +1,280 @@
+#include "stdafx.h"
+#include <cstdint>
+
+#include "module.h"
+
+// A module is
+//   "CORM" u32 version u32 flags
+//   u32 n_deps { str path, u64 hash }
+//   u32 n_typedefs { str name, u32 n_members { type } }
+//   u32 n_prototypes { str name, str return_type, u8 pure, u8 attributes, u32 n_args { str name, type } }
+// where a str is a u32 length and the characters, and a type is 'n' and the
+// name of a defined type, 'a' u32 count type for an array or 's' str type
+// for a slice with its length local
+
+namespace core {
+    static const uint32_t module_version = 2;
+    // The source had function definitions or constants, so it can't stand
+    // in for them
+    static const uint32_t module_has_definitions = 1;
+    
+    struct module_writer {
+        std::string data;
+        
+        template<typename T>
+            void put(T v) {
+            data.append((const char*)&v, sizeof(v));
+        }
+        
+        void put_string(const std::string& s) {
+            put<uint32_t>(s.size());
+            data += s;
+        }
+        
+        void put_type(type* pType) {
+            if(auto pArray = dynamic_cast<array_type*>(pType)) {
+                put<char>('a');
+                put<uint32_t>(pArray->max_count);
+                put_type(pArray->contained.get());
+            } else if(auto pSlice = dynamic_cast<slice_type*>(pType)) {
+                put<char>('s');
+                put_string(pSlice->length_name);
+                put_type(pSlice->contained.get());
+            } else if(auto pAggr = dynamic_cast<aggregate_type*>(pType)) {
+                put<char>('n');
+                put_string(pAggr->name);
+            } else {
+                put<char>('n');
+                put_string(pType->get_type_name());
+            }
+        }
+    };
+    
+    struct module_reader {
+        module_reader(const llvm::MemoryBuffer& module)
+            : p(module.getBufferStart()), end(module.getBufferEnd()) {}
+        
+        const char* p;
+        const char* end;
+        // Cleared on reading past the end or anything malformed
+        bool ok = true;
+        
+        template<typename T>
+            T get() {
+            T v = T();
+            if(end - p < (ptrdiff_t)sizeof(T)) {
+                ok = false;
+                return v;
+            }
+            memcpy(&v, p, sizeof(T));
+            p += sizeof(T);
+            return v;
+        }
+        
+        std::string get_string() {
+            auto len = get<uint32_t>();
+            if(!ok || end - p < (ptrdiff_t)len) {
+                ok = false;
+                return std::string();
+            }
+            std::string s(p, len);
+            p += len;
+            return s;
+        }
+        
+        sp<type> get_type(type_manager& type_mgr) {
+            sp<type> ret;
+            auto tag = get<char>();
+            if(tag == 'n') {
+                auto name = get_string();
+                if(ok && type_mgr.is_type_defined(name)) {
+                    ret = type_mgr.m_type_map[name];
+                }
+            } else if(tag == 'a') {
+                auto count = get<uint32_t>();
+                auto contained = get_type(type_mgr);
+                if(contained) {
+                    ret = std::make_shared<array_type>(contained, (int)count);
+                }
+            } else if(tag == 's') {
+                auto length_name = get_string();
+                auto contained = get_type(type_mgr);
+                if(contained) {
+                    ret = std::make_shared<slice_type>(contained, length_name);
+                }
+            }
+            if(!ret) {
+                ok = false;
+            }
+            return ret;
+        }
+    };
+    
+    bool hash_file(const std::string& path, uint64_t& hash) {
+        auto buffer = llvm::MemoryBuffer::getFile(path, -1, false);
+        if(!buffer) {
+            return false;
+        }
+        hash = llvm::xxHash64((*buffer)->getBuffer());
+        return true;
+    }
+    
+    module_buffer open_module(const std::string& path, bool& has_definitions, const char*& pszError) {
+        // Not null terminated, so it's mapped rather than read
+        auto buffer = llvm::MemoryBuffer::getFile(path, -1, false);
+        if(!buffer) {
+            pszError = "couldn't open it";
+            return nullptr;
+        }
+        
+        module_reader r(**buffer);
+        char magic[4];
+        for(auto& c : magic) {
+            c = r.get<char>();
+        }
+        auto version = r.get<uint32_t>();
+        auto flags = r.get<uint32_t>();
+        if(!r.ok || memcmp(magic, "CORM", 4) != 0 || version != module_version) {
+            pszError = "it isn't a module of this version of corec";
+            return nullptr;
+        }
+        has_definitions = flags & module_has_definitions;
+        
+        auto n_deps = r.get<uint32_t>();
+        for(uint32_t i = 0; i < n_deps && r.ok; i++) {
+            auto dep = r.get_string();
+            auto expected = r.get<uint64_t>();
+            uint64_t hash;
+            if(r.ok && (!hash_file(dep, hash) || hash != expected)) {
+                pszError = "it's out of date";
+                return nullptr;
+            }
+        }
+        if(!r.ok) {
+            pszError = "it's malformed";
+            return nullptr;
+        }
+        return std::move(*buffer);
+    }
+    
+    bool load_module(llvm_ctx& ctx, type_manager& type_mgr, const llvm::MemoryBuffer& module) {
+        module_reader r(module);
+        // Checked by open_module
+        r.p += 12;
+        auto n_deps = r.get<uint32_t>();
+        for(uint32_t i = 0; i < n_deps && r.ok; i++) {
+            r.get_string();
+            r.get<uint64_t>();
+        }
+        
+        auto n_typedefs = r.get<uint32_t>();
+        for(uint32_t i = 0; i < n_typedefs && r.ok; i++) {
+            auto ty = std::make_shared<aggregate_type>();
+            ty->name = r.get_string();
+            auto n_members = r.get<uint32_t>();
+            for(uint32_t j = 0; j < n_members && r.ok; j++) {
+                ty->members.push_back(r.get_type(type_mgr));
+            }
+            // Also defined by another module or the source
+            if(r.ok && !type_mgr.is_type_defined(ty->name)) {
+                type_mgr.add_type(ty->name, ty);
+            }
+        }
+        
+        auto n_prototypes = r.get<uint32_t>();
+        for(uint32_t i = 0; i < n_prototypes && r.ok; i++) {
+            ast_prototype proto;
+            proto.name = std::make_unique<ast_identifier>(r.get_string().c_str());
+            proto.type = std::make_unique<ast_identifier>(r.get_string().c_str());
+            proto.is_pure = r.get<uint8_t>();
+            proto.attributes = r.get<uint8_t>();
+            proto.line = proto.col = 0;
+            auto n_args = r.get<uint32_t>();
+            for(uint32_t j = 0; j < n_args && r.ok; j++) {
+                ast_declaration arg;
+                arg.identifier = std::make_unique<ast_identifier>(r.get_string().c_str());
+                arg.type = r.get_type(type_mgr);
+                proto.args.push_back(std::move(arg));
+            }
+            if(r.ok && !proto.generate_ir(ctx)) {
+                return false;
+            }
+        }
+        
+        if(!r.ok) {
+            fprintf(stderr, "Module '%s' is malformed\n", module.getBufferIdentifier().str().c_str());
+        }
+        return r.ok;
+    }
+    
+    bool write_module(const char* pszPath, std::vector<up<ast_expression>>& exprs, type_manager& type_mgr, const std::vector<std::string>& deps) {
+        module_writer w;
+        std::vector<ast_prototype*> prototypes;
+        bool has_definitions = false;
+        for(auto& expr : exprs) {
+            if(auto pProto = dynamic_cast<ast_prototype*>(expr.get())) {
+                prototypes.push_back(pProto);
+            } else if(auto pFunc = dynamic_cast<ast_function*>(expr.get())) {
+                prototypes.push_back(pFunc->prototype.get());
+                has_definitions = true;
+            } else if(dynamic_cast<ast_const*>(expr.get())) {
+                // Only the source has the values
+                has_definitions = true;
+            }
+        }
+        
+        w.data = "CORM";
+        w.put<uint32_t>(module_version);
+        w.put<uint32_t>(has_definitions ? module_has_definitions : 0);
+        
+        w.put<uint32_t>(deps.size());
+        for(auto& dep : deps) {
+            uint64_t hash;
+            if(!hash_file(dep, hash)) {
+                fprintf(stderr, "Couldn't read '%s'\n", dep.c_str());
+                return false;
+            }
+            w.put_string(dep);
+            w.put<uint64_t>(hash);
+        }
+        
+        // Every typedef, including those of imported modules, so the
+        // module can be loaded on its own
+        std::vector<aggregate_type*> typedefs;
+        for(auto& ty : type_mgr.m_types) {
+            if(auto pAggr = dynamic_cast<aggregate_type*>(ty.get())) {
+                typedefs.push_back(pAggr);
+            }
+        }
+        w.put<uint32_t>(typedefs.size());
+        for(auto pAggr : typedefs) {
+            w.put_string(pAggr->name);
+            w.put<uint32_t>(pAggr->members.size());
+            for(auto& member : pAggr->members) {
+                w.put_type(member.get());
+            }
+        }
+        
+        w.put<uint32_t>(prototypes.size());
+        for(auto pProto : prototypes) {
+            w.put_string(((ast_identifier*)pProto->name.get())->name);
+            w.put_string(pProto->type->name);
+            w.put<uint8_t>(pProto->is_pure);
+            w.put<uint8_t>(pProto->attributes);
+            w.put<uint32_t>(pProto->args.size());
+            for(auto& arg : pProto->args) {
+                w.put_string(arg.identifier->name);
+                w.put_type(arg.type.get());
+            }
+        }
+        
+        std::error_code ec;
+        llvm::raw_fd_ostream out(pszPath, ec, llvm::sys::fs::F_None);
+        if(ec) {
+            fprintf(stderr, "Couldn't open destination module file '%s'\n", pszPath);
+            return false;
+        }
+        out << w.data;
+        return true;
+    }
+}
\ No newline at end of file
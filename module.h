@@ -0,0 +1,25 @@
+#pragma once
+
+#include "ast.h"
+#include "type.h"
+
+// Precompiled module interfaces. corec -emit-module writes the typedefs and
+// the function prototypes of a source file to a .corm file, along with a
+// hash of every file it was made from. `#import lib.corm` declares what
+// lib.cor defines, for when lib.o is linked in separately; `#include lib.cor`
+// reads lib.corm in its place if lib.cor has no function definitions or
+// constants, which modules don't hold. Either way, a module that's out of
+// date with its files isn't used.
+
+namespace core {
+    using module_buffer = std::unique_ptr<llvm::MemoryBuffer>;
+    
+    // Maps a module if it's up to date; on failure, pszError says why
+    module_buffer open_module(const std::string& path, bool& has_definitions, const char*& pszError);
+    // Declares the typedefs and the functions of a module
+    bool load_module(llvm_ctx& ctx, type_manager& type_mgr, const llvm::MemoryBuffer& module);
+    // deps are the real paths of the files the source was made from
+    bool write_module(const char* pszPath, std::vector<up<ast_expression>>& exprs, type_manager& type_mgr, const std::vector<std::string>& deps);
+    // Hash of the contents of a file, that modules are checked against
+    bool hash_file(const std::string& path, uint64_t& hash);
+}
\ No newline at end of file
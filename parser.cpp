@@ -13,6 +13,8 @@ namespace core {
             case '!': return 3;
             case '<': return 3;
             case '>': return 3;
+            case '|': return 1;
+            case '&': return 2;
             case '+': return 5;
             case '-': return 5;
             case '*': return 10;
@@ -22,6 +24,14 @@ namespace core {
         return -1;
     }
     
+    // Precedence of the current token; -1 if it's not an operator
+    static int token_precedence(token_stream& ts) {
+        if(ts.type() != tok_t::oper) {
+            return -1;
+        }
+        return operator_precedence(ts.current()[0]);
+    }
+    
     static up<ast_expression> parse_typedef(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
         up<ast_expression> ret = nullptr;
         assert(ts.type() == tok_t::type);
@@ -144,6 +154,14 @@ namespace core {
             is_bool = true;
             is_real = is_int = false;
         }
+        if(s.size() >= 2 && s.front() == '"') {
+            // String literals are only used for file names
+            auto ret = std::make_unique<ast_literal>(s.substr(1, s.size() - 2));
+            ret->is_string = true;
+            ret->line = line; ret->col = col;
+            ts.step();
+            return ret;
+        }
         if(is_real || is_int || is_bool) {
             auto ret = std::make_unique<ast_literal>(s);
             ret->is_real = is_real;
@@ -205,6 +223,51 @@ namespace core {
         }
     }
     
+    static up<ast_expression> parse_array_literal(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
+        block_msg __bpal("parse array literal");
+        auto ret = std::make_unique<ast_array_literal>();
+        ret->line = ts.line(); ret->col = ts.col();
+        ts.step(); // Eat curly open
+        
+        while(!ts.empty() && ts.type() != tok_t::curly_close) {
+            auto elem = parse_expression(ts, ctx, type_mgr);
+            if(!elem) {
+                return nullptr;
+            }
+            ret->elements.push_back(std::move(elem));
+            if(!ts.empty() && ts.current() == ",") {
+                ts.step();
+            } else if(!ts.empty() && ts.type() != tok_t::curly_close) {
+                log_err(ts, "Expected comma or closing curly braces in array literal\n");
+                return nullptr;
+            }
+        }
+        
+        if(ts.empty()) {
+            log_err(ret.get(), "Expected closing curly braces after array literal\n");
+            return nullptr;
+        }
+        ts.step(); // Eat curly close
+        return ret;
+    }
+    
+    static up<ast_expression> parse_unary_op(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
+        block_msg __bpu("parse unary operation");
+        int line = ts.line(), col = ts.col();
+        char op = ts.current()[0];
+        ts.step(); // Eat operator
+        
+        auto operand = parse_primary(ts, ctx, type_mgr);
+        if(!operand) {
+            log_err(ts, "Expected operand of unary operation\n");
+            return nullptr;
+        }
+        
+        auto ret = std::make_unique<ast_unary_op>(op, std::move(operand));
+        ret->line = line; ret->col = col;
+        return ret;
+    }
+    
     static up<ast_expression> parse_primary(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
         block_msg __bpp("parse primary");
         switch(ts.type()) {
@@ -214,6 +277,14 @@ namespace core {
             return parse_literal(ts, ctx);
             case tok_t::paren_open:
             return parse_paren_expr(ts, ctx, type_mgr);
+            case tok_t::curly_open:
+            return parse_array_literal(ts, ctx, type_mgr);
+            case tok_t::oper:
+            if(ts.current() == "!") {
+                return parse_unary_op(ts, ctx, type_mgr);
+            }
+            log_err(ts, "Unexpected operator '%s'\n", ts.current().c_str());
+            break;
             default:
             log_err(ts, "Unknown token '%s' of type %d\n",ts.current().c_str(), (int)ts.type());
             break;
@@ -226,7 +297,7 @@ namespace core {
         while(1) {
             int line = ts.line(), col = ts.col();
             char bin_op = ts.current()[0];
-            int tok_prec = operator_precedence(bin_op);
+            int tok_prec = token_precedence(ts);
             if(tok_prec < expr_prec) {
                 return lhs;
             }
@@ -239,7 +310,7 @@ namespace core {
                 return nullptr;
             }
             
-            int next_prec = operator_precedence(ts.current()[0]);
+            int next_prec = token_precedence(ts);
             if(tok_prec < next_prec) {
                 block_msg __bpborr("parse binary operation rhs recurse");
                 rhs = parse_binary_operation_rhs(ts, ctx, tok_prec + 1, std::move(rhs), type_mgr);
@@ -254,11 +325,210 @@ namespace core {
         }
     }
     
+    static up<ast_expression> parse_line(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr);
+    
+    // Parses an optional '(' N ')' after a loop hint
+    static bool parse_hint_argument(token_stream& ts, unsigned& value) {
+        if(ts.type() != tok_t::paren_open) {
+            return true;
+        }
+        ts.step();
+        if(ts.type() != tok_t::literal) {
+            log_err(ts, "Expected an integer argument in loop hint\n");
+            return false;
+        }
+        value = (unsigned)std::stoul(ts.current());
+        ts.step();
+        if(ts.type() != tok_t::paren_close) {
+            log_err(ts, "Expected closing parentheses after loop hint argument\n");
+            return false;
+        }
+        ts.step();
+        return true;
+    }
+    
+    // Parses the list of locals in 'reduce(a, b)'
+    static bool parse_reductions(token_stream& ts, std::vector<std::string>& reductions) {
+        if(ts.type() != tok_t::paren_open) {
+            log_err(ts, "Expected the reduced variables in parentheses after 'reduce'\n");
+            return false;
+        }
+        ts.step();
+        while(ts.type() == tok_t::identifier) {
+            reductions.push_back(ts.current());
+            ts.step();
+            if(ts.current() == ",") {
+                ts.step();
+            }
+        }
+        if(ts.type() != tok_t::paren_close) {
+            log_err(ts, "Expected closing parentheses after the reduced variables\n");
+            return false;
+        }
+        ts.step();
+        return true;
+    }
+    
+    // Hints between the loop header and the body, like 'unroll(4) vectorize';
+    // reductions is only passed for parallel loops
+    static bool parse_loop_hints(token_stream& ts, loop_hints& hints, std::vector<std::string>* reductions = nullptr) {
+        while(ts.type() == tok_t::identifier) {
+            auto hint = ts.current();
+            ts.step();
+            if(hint == "reduce") {
+                if(!reductions) {
+                    log_err(ts, "Only parallel loops can have reductions\n");
+                    return false;
+                }
+                if(!parse_reductions(ts, *reductions)) {
+                    return false;
+                }
+            } else if(hint == "unroll") {
+                hints.unroll = true;
+                if(!parse_hint_argument(ts, hints.unroll_count)) {
+                    return false;
+                }
+            } else if(hint == "vectorize") {
+                hints.vectorize = true;
+                if(!parse_hint_argument(ts, hints.vectorize_width)) {
+                    return false;
+                }
+            } else {
+                log_err(ts, "Unknown loop hint '%s'\n", hint.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // Parses the statements between curly braces into lines; owner is the
+    // statement the block belongs to
+    static bool parse_block(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr, const ast_expression* owner, std::vector<up<ast_expression>>& lines) {
+        if(ts.type() != tok_t::curly_open) {
+            log_err(ts, "Expected opening curly braces\n");
+            return false;
+        }
+        
+        ts.step(); // Eat curly open
+        
+        while(!ts.empty() && ts.type() != tok_t::curly_close) {
+            auto line = parse_line(ts, ctx, type_mgr);
+            if(!line) {
+                return false;
+            }
+            lines.push_back(std::move(line));
+        }
+        
+        if(ts.empty()) {
+            log_err(owner, "Expected closing curly braces\n");
+            return false;
+        }
+        
+        ts.step(); // Eat curly close
+        return true;
+    }
+    
+    static up<ast_expression> parse_while(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
+        block_msg __bpw("parse while");
+        int line = ts.line(), col = ts.col();
+        ts.step(); // Eat 'while'
+        
+        if(ts.type() != tok_t::paren_open) {
+            log_err(ts, "Expected condition in parentheses after 'while'\n");
+            return nullptr;
+        }
+        auto cond = parse_paren_expr(ts, ctx, type_mgr);
+        if(!cond) {
+            return nullptr;
+        }
+        
+        auto ret = std::make_unique<ast_while>();
+        ret->condition = std::move(cond);
+        ret->line = line; ret->col = col;
+        if(!parse_loop_hints(ts, ret->hints) || !parse_block(ts, ctx, type_mgr, ret.get(), ret->body)) {
+            return nullptr;
+        }
+        return ret;
+    }
+    
+    static up<ast_expression> parse_for(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
+        block_msg __bpf("parse for");
+        int line = ts.line(), col = ts.col();
+        bool parallel = false;
+        if(ts.type() == tok_t::parallel) {
+            parallel = true;
+            ts.step(); // Eat 'parallel'
+            if(ts.type() != tok_t::cfor) {
+                log_err(ts, "Expected 'for' after 'parallel'\n");
+                return nullptr;
+            }
+        }
+        ts.step(); // Eat 'for'
+        
+        if(ts.type() != tok_t::identifier) {
+            log_err(ts, "Expected induction variable after 'for'\n");
+            return nullptr;
+        }
+        
+        auto ret = std::make_unique<ast_for>();
+        ret->var = parse_declaration(ts, ctx, type_mgr);
+        if(!ret->var.identifier) {
+            return nullptr;
+        }
+        
+        if(ts.type() != tok_t::from) {
+            log_err(ts, "Expected 'from' in for loop\n");
+            return nullptr;
+        }
+        ts.step();
+        ret->from = parse_expression(ts, ctx, type_mgr);
+        if(!ret->from) {
+            return nullptr;
+        }
+        
+        if(ts.type() != tok_t::to) {
+            log_err(ts, "Expected 'to' in for loop\n");
+            return nullptr;
+        }
+        ts.step();
+        ret->to = parse_expression(ts, ctx, type_mgr);
+        if(!ret->to) {
+            return nullptr;
+        }
+        
+        ret->line = line; ret->col = col;
+        ret->parallel = parallel;
+        if(!parse_loop_hints(ts, ret->hints, parallel ? &ret->reductions : nullptr) || !parse_block(ts, ctx, type_mgr, ret.get(), ret->body)) {
+            return nullptr;
+        }
+        return ret;
+    }
+    
     static up<ast_expression> parse_expression(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
         block_msg __bpe("parse expression");
-        if(ts.type() == tok_t::cif) { // branching
+        if(ts.type() == tok_t::cwhile) {
+            return parse_while(ts, ctx, type_mgr);
+        } else if(ts.type() == tok_t::cfor || ts.type() == tok_t::parallel) {
+            return parse_for(ts, ctx, type_mgr);
+        } else if(ts.type() == tok_t::cif) { // branching
             block_msg __bpeif("parsing branching");
             ts.step();
+            auto hint = branch_hint::none;
+            if(ts.type() == tok_t::identifier) {
+                if(ts.current() == "likely") {
+                    hint = branch_hint::likely;
+                } else if(ts.current() == "unlikely") {
+                    hint = branch_hint::unlikely;
+                } else {
+                    log_err(ts, "Unknown branch hint '%s'\n", ts.current().c_str());
+                    return nullptr;
+                }
+                ts.step(); // Eat hint
+            }
+            if(ts.type() != tok_t::paren_open) {
+                log_err(ts, "Expected opening parentheses after 'if'\n");
+                return nullptr;
+            }
             auto cond = parse_paren_expr(ts, ctx, type_mgr);
             if(ts.type() != tok_t::cthen) {
                 log_err(ts, "Expected 'then' after condition in branching, got %d\n", (int)ts.type());
@@ -270,6 +540,7 @@ namespace core {
             auto ret = std::make_unique<ast_branching>();
             ret->condition = std::move(cond);
             ret->line = std::move(line);
+            ret->hint = hint;
             
             return ret;
         } else { // line
@@ -282,24 +553,83 @@ namespace core {
         }
     }
     
+    // Loops end in a block, so the semicolon after them is optional
+    static bool ends_with_block(const ast_expression* expr) {
+        if(dynamic_cast<const ast_while*>(expr) || dynamic_cast<const ast_for*>(expr)) {
+            return true;
+        }
+        auto pBranch = dynamic_cast<const ast_branching*>(expr);
+        return pBranch && ends_with_block(pBranch->line.get());
+    }
+    
     static up<ast_expression> parse_line(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
         auto ret = parse_expression(ts, ctx, type_mgr);
+        if(ret && ends_with_block(ret.get()) && (ts.empty() || ts.type() != tok_t::semicolon)) {
+            return ret;
+        }
         assert(ts.type() == tok_t::semicolon);
         ts.step(); // Eat semicolon
         return ret;
     }
     
+    // Modifiers before the name of a function, like 'pure cold'; besides
+    // pure, they're only words before the name, so they can still name
+    // functions and variables
+    static bool parse_function_modifiers(token_stream& ts, bool& is_pure, unsigned& attributes) {
+        while(true) {
+            if(ts.type() == tok_t::pure) {
+                is_pure = true;
+                ts.step(); // Eat pure
+                continue;
+            }
+            if(ts.type() != tok_t::identifier || ts.next_type() != tok_t::identifier) {
+                break;
+            }
+            
+            auto modifier = ts.current();
+            if(modifier == "inline") {
+                attributes |= fn_inline;
+            } else if(modifier == "noinline") {
+                attributes |= fn_noinline;
+            } else if(modifier == "hot") {
+                attributes |= fn_hot;
+            } else if(modifier == "cold") {
+                attributes |= fn_cold;
+            } else if(modifier == "flatten") {
+                attributes |= fn_flatten;
+            } else if(modifier == "fastmath") {
+                attributes |= fn_fastmath;
+            } else if(modifier == "memo") {
+                attributes |= fn_memo;
+            } else {
+                log_err(ts, "Unknown function modifier '%s'\n", modifier.c_str());
+                return false;
+            }
+            ts.step(); // Eat modifier
+        }
+        
+        if((attributes & fn_inline) && (attributes & fn_noinline)) {
+            log_err(ts, "A function can't be both inline and noinline\n");
+            return false;
+        }
+        if((attributes & fn_hot) && (attributes & fn_cold)) {
+            log_err(ts, "A function can't be both hot and cold\n");
+            return false;
+        }
+        return true;
+    }
+    
     static up<ast_prototype> parse_prototype(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
         up<ast_prototype> ret;
         up<ast_expression> name;
         std::vector<ast_declaration> args;
         
         bool is_pure = false;
+        unsigned attributes = 0;
         int line = ts.line(), col = ts.col();
         
-        if(ts.type() == tok_t::pure) {
-            is_pure = true;
-            ts.step(); // Eat pure
+        if(!parse_function_modifiers(ts, is_pure, attributes)) {
+            return nullptr;
         }
         
         if(ts.type() != tok_t::identifier) {
@@ -347,6 +677,7 @@ namespace core {
         ret->args = std::move(args);
         ret->type = std::move(type);
         ret->is_pure = is_pure;
+        ret->attributes = attributes;
         ret->line = line; ret->col = col;
         
         return ret;
@@ -403,6 +734,44 @@ namespace core {
         return ret;
     }
     
+    static up<ast_expression> parse_const(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
+        assert(ts.type() == tok_t::cconst);
+        auto ret = std::make_unique<ast_const>();
+        ret->line = ts.line(); ret->col = ts.col();
+        
+        ts.step(); // Eat const
+        
+        if(ts.type() != tok_t::identifier) {
+            log_err(ts, "Expected identifier after 'const'\n");
+            return nullptr;
+        }
+        
+        ret->decl = parse_declaration(ts, ctx, type_mgr);
+        if(!ret->decl.identifier || !ret->decl.type) {
+            return nullptr;
+        }
+        
+        if(ts.empty() || ts.current() != "=") {
+            log_err(ret.get(), "Constant '%s' needs a value\n", ret->decl.identifier->name);
+            return nullptr;
+        }
+        
+        ts.step(); // Eat =
+        
+        ret->value = parse_expression(ts, ctx, type_mgr);
+        if(!ret->value) {
+            return nullptr;
+        }
+        
+        if(ts.empty() || ts.type() != tok_t::semicolon) {
+            log_err(ret.get(), "Expected semicolon at end of constant\n");
+            return nullptr;
+        }
+        ts.step(); // Eat semicolon
+        
+        return ret;
+    }
+    
     up<ast_expression> parse(token_stream& ts, llvm_ctx& ctx, type_manager& type_mgr) {
         up<ast_expression> ret;
         
@@ -416,6 +785,9 @@ namespace core {
             case tok_t::type:
             ret = parse_typedef(ts, ctx, type_mgr);
             break;
+            case tok_t::cconst:
+            ret = parse_const(ts, ctx, type_mgr);
+            break;
             default:
             log_err(ts, "Unknown top level expression\n");
             assert(0);
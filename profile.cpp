@@ -0,0 +1,204 @@
+#include "stdafx.h"
+#include <cinttypes>
+
+#include "profile.h"
+
+using namespace llvm;
+
+namespace core {
+    bool read_profile(llvm_ctx& ctx, const char* pszPath) {
+        auto f = fopen(pszPath, "r");
+        if(!f) {
+            fprintf(stderr, "Couldn't open profile '%s'\n", pszPath);
+            return false;
+        }
+        
+        char name[256];
+        uint64_t entry, n_branches;
+        bool ret = fgets(name, sizeof(name), f) && strncmp(name, "# corec profile", 15) == 0;
+        while(ret && fscanf(f, " fn %255s %" SCNu64 " %" SCNu64, name, &entry, &n_branches) == 3) {
+            auto& prof = ctx.profile[name];
+            prof.entry = entry;
+            prof.branches.resize(n_branches);
+            for(auto& br : prof.branches) {
+                if(fscanf(f, "%" SCNu64 " %" SCNu64, &br.first, &br.second) != 2) {
+                    ret = false;
+                    break;
+                }
+            }
+        }
+        if(!ret || !feof(f)) {
+            fprintf(stderr, "Profile '%s' is malformed\n", pszPath);
+            ret = false;
+        }
+        fclose(f);
+        return ret;
+    }
+    
+    static void increment_counter(llvm_ctx& ctx, llvm::Value* pVIndex) {
+        auto pTyInt64 = Type::getInt64Ty(ctx.ctx);
+        auto pCounter = ctx.builder.CreateGEP(ctx.prof_counters, { ConstantInt::get(pTyInt64, 0), pVIndex }, "profctr");
+        auto pVCount = ctx.builder.CreateLoad(pCounter, "profcnt");
+        ctx.builder.CreateStore(ctx.builder.CreateAdd(pVCount, ConstantInt::get(pTyInt64, 1)), pCounter);
+    }
+    
+    // The runtime keeps the call count and times of a function in a slot:
+    // { name, next slot, calls, inclusive ns, exclusive ns }
+    static llvm::Value* get_instrument_slot(llvm_ctx& ctx, llvm::Function* pFunc) {
+        auto pTyInt64 = Type::getInt64Ty(ctx.ctx);
+        auto pTyInt8Ptr = Type::getInt8PtrTy(ctx.ctx);
+        auto name = pFunc->getName().str();
+        auto pName = ConstantDataArray::getString(ctx.ctx, name);
+        auto pGVName = new GlobalVariable(ctx.module, pName->getType(), true, GlobalValue::PrivateLinkage, pName, "corec.instr.name");
+        
+        auto pTySlot = StructType::get(ctx.ctx, { pTyInt8Ptr, pTyInt8Ptr, pTyInt64, pTyInt64, pTyInt64 });
+        auto pInit = ConstantStruct::get(pTySlot, {
+            ConstantExpr::getBitCast(pGVName, pTyInt8Ptr),
+            ConstantPointerNull::get(pTyInt8Ptr),
+            ConstantInt::get(pTyInt64, 0),
+            ConstantInt::get(pTyInt64, 0),
+            ConstantInt::get(pTyInt64, 0),
+        });
+        auto pSlot = new GlobalVariable(ctx.module, pTySlot, false, GlobalValue::InternalLinkage, pInit, "corec.instr." + name);
+        return ConstantExpr::getBitCast(pSlot, pTyInt8Ptr);
+    }
+    
+    static llvm::CallInst* call_instrument(IRBuilder<>& B, llvm_ctx& ctx, const char* pszName, llvm::Value* pSlot) {
+        auto pTyHook = FunctionType::get(Type::getVoidTy(ctx.ctx), { Type::getInt8PtrTy(ctx.ctx) }, false);
+        return B.CreateCall(ctx.module.getOrInsertFunction(pszName, pTyHook), { pSlot });
+    }
+    
+    void profile_function_begin(llvm_ctx& ctx, llvm::Function* pFunc) {
+        if(ctx.instrument_functions) {
+            ctx.instr_slot = get_instrument_slot(ctx, pFunc);
+            call_instrument(ctx.builder, ctx, "corert_func_enter", ctx.instr_slot);
+        }
+        
+        ctx.prof_branch = 0;
+        ctx.prof_current = nullptr;
+        if(ctx.profile_generate) {
+            if(!ctx.prof_counters) {
+                // Resized by finish_profile once every function is generated
+                auto pTyCounters = ArrayType::get(Type::getInt64Ty(ctx.ctx), 0);
+                ctx.prof_counters = new GlobalVariable(ctx.module, pTyCounters, false, GlobalValue::InternalLinkage, Constant::getNullValue(pTyCounters), "corec.prof.counters");
+            }
+            ctx.prof_functions.emplace_back(pFunc->getName().str(), ctx.prof_n_counters);
+            increment_counter(ctx, ConstantInt::get(Type::getInt64Ty(ctx.ctx), ctx.prof_n_counters++));
+        } else if(ctx.profile.count(pFunc->getName().str())) {
+            ctx.prof_current = &ctx.profile[pFunc->getName().str()];
+            pFunc->setEntryCount(ctx.prof_current->entry);
+        }
+    }
+    
+    void profile_function_end(llvm_ctx& ctx, llvm::Function* pFunc) {
+        if(ctx.instrument_functions) {
+            for(auto& BB : *pFunc) {
+                if(auto pRet = dyn_cast_or_null<ReturnInst>(BB.getTerminator())) {
+                    IRBuilder<> TmpB(pRet);
+                    call_instrument(TmpB, ctx, "corert_func_exit", ctx.instr_slot);
+                }
+            }
+        }
+        
+        if(!ctx.prof_current || ctx.prof_branch == ctx.prof_current->branches.size()) {
+            return;
+        }
+        // The function has changed since it was profiled
+        fprintf(stderr, "Warning: profile of function '%s' is out of date, ignoring its branches\n", pFunc->getName().str().c_str());
+        for(auto& BB : *pFunc) {
+            if(auto pTerm = BB.getTerminator()) {
+                pTerm->setMetadata(LLVMContext::MD_prof, nullptr);
+            }
+        }
+        ctx.prof_current = nullptr;
+    }
+    
+    // Branch weights are 32 bit; like clang, counts are scaled down to fit
+    // and never made zero
+    static uint32_t scale_weight(uint64_t count, uint64_t scale) {
+        return (uint32_t)(count / scale + 1);
+    }
+    
+    llvm::BranchInst* create_cond_br(llvm_ctx& ctx, llvm::Value* pVCond, llvm::BasicBlock* pBBTrue, llvm::BasicBlock* pBBFalse) {
+        auto site = ctx.prof_branch++;
+        if(ctx.profile_generate) {
+            // Taken and not taken are two adjacent counters
+            auto pTyInt64 = Type::getInt64Ty(ctx.ctx);
+            auto first = ctx.prof_n_counters;
+            ctx.prof_n_counters += 2;
+            increment_counter(ctx, ctx.builder.CreateSelect(pVCond, ConstantInt::get(pTyInt64, first), ConstantInt::get(pTyInt64, first + 1), "profidx"));
+        }
+        auto br = ctx.builder.CreateCondBr(pVCond, pBBTrue, pBBFalse);
+        if(ctx.prof_current && site < ctx.prof_current->branches.size()) {
+            auto& counts = ctx.prof_current->branches[site];
+            uint64_t scale = std::max(counts.first, counts.second) / UINT32_MAX + 1;
+            br->setMetadata(LLVMContext::MD_prof, MDBuilder(ctx.ctx).createBranchWeights(scale_weight(counts.first, scale), scale_weight(counts.second, scale)));
+        }
+        return br;
+    }
+    
+    // Registers the counters with a constructor calling
+    // corert_profile_register(functions, n_functions, counters, path), where
+    // every function is { name, first counter, number of branches }
+    static void register_counters(llvm_ctx& ctx) {
+        auto pTyInt64 = Type::getInt64Ty(ctx.ctx);
+        auto pTyInt8Ptr = Type::getInt8PtrTy(ctx.ctx);
+        
+        auto pTyCounters = ArrayType::get(pTyInt64, ctx.prof_n_counters);
+        auto pCounters = new GlobalVariable(ctx.module, pTyCounters, false, GlobalValue::InternalLinkage, Constant::getNullValue(pTyCounters));
+        pCounters->takeName(ctx.prof_counters);
+        ctx.prof_counters->replaceAllUsesWith(ConstantExpr::getBitCast(pCounters, ctx.prof_counters->getType()));
+        ctx.prof_counters->eraseFromParent();
+        ctx.prof_counters = pCounters;
+        
+        auto pTyRecord = StructType::get(ctx.ctx, { pTyInt8Ptr, pTyInt64, pTyInt64 });
+        std::vector<Constant*> records;
+        for(size_t i = 0; i < ctx.prof_functions.size(); i++) {
+            auto& fn = ctx.prof_functions[i];
+            auto next = i + 1 < ctx.prof_functions.size() ? ctx.prof_functions[i + 1].second : ctx.prof_n_counters;
+            auto pName = ConstantDataArray::getString(ctx.ctx, fn.first);
+            auto pGVName = new GlobalVariable(ctx.module, pName->getType(), true, GlobalValue::PrivateLinkage, pName, "corec.prof.name");
+            records.push_back(ConstantStruct::get(pTyRecord, {
+                ConstantExpr::getBitCast(pGVName, pTyInt8Ptr),
+                ConstantInt::get(pTyInt64, fn.second),
+                ConstantInt::get(pTyInt64, (next - fn.second - 1) / 2),
+            }));
+        }
+        auto pTyRecords = ArrayType::get(pTyRecord, records.size());
+        auto pRecords = new GlobalVariable(ctx.module, pTyRecords, true, GlobalValue::InternalLinkage, ConstantArray::get(pTyRecords, records), "corec.prof.functions");
+        auto pPath = ConstantDataArray::getString(ctx.ctx, ctx.profile_path);
+        auto pGVPath = new GlobalVariable(ctx.module, pPath->getType(), true, GlobalValue::PrivateLinkage, pPath, "corec.prof.path");
+        
+        auto pTyInit = FunctionType::get(Type::getVoidTy(ctx.ctx), false);
+        auto pInit = Function::Create(pTyInit, Function::InternalLinkage, "corec.prof.init", &ctx.module);
+        IRBuilder<> B(BasicBlock::Create(ctx.ctx, "entry", pInit));
+        auto pTyRegister = FunctionType::get(Type::getVoidTy(ctx.ctx), { pTyInt8Ptr, pTyInt64, pTyInt64->getPointerTo(), pTyInt8Ptr }, false);
+        B.CreateCall(ctx.module.getOrInsertFunction("corert_profile_register", pTyRegister), {
+            ConstantExpr::getBitCast(pRecords, pTyInt8Ptr),
+            ConstantInt::get(pTyInt64, records.size()),
+            ConstantExpr::getBitCast(pCounters, pTyInt64->getPointerTo()),
+            ConstantExpr::getBitCast(pGVPath, pTyInt8Ptr),
+        });
+        B.CreateRetVoid();
+        appendToGlobalCtors(ctx.module, pInit, 0);
+    }
+    
+    void finish_profile(llvm_ctx& ctx) {
+        if(ctx.profile_generate && ctx.prof_counters) {
+            register_counters(ctx);
+        } else if(!ctx.profile.empty()) {
+            // The summary tells which counts are hot, for the inliner and
+            // the code layout
+            InstrProfSummaryBuilder builder(ProfileSummaryBuilder::DefaultCutoffs);
+            for(auto& entry : ctx.profile) {
+                std::vector<uint64_t> counts = { entry.second.entry };
+                for(auto& br : entry.second.branches) {
+                    counts.push_back(br.first);
+                    counts.push_back(br.second);
+                }
+                builder.addRecord(InstrProfRecord(counts));
+            }
+            ctx.module.setProfileSummary(builder.getSummary()->getMD(ctx.ctx));
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "types.h"
+
+// Profile guided optimization. With -fprofile-generate, every function
+// entry and both edges of every conditional branch are counted, and the
+// runtime writes the counts at exit. With -fprofile-use, the counts become
+// function entry counts and branch weights.
+// With -finstrument-functions, the runtime is told about every entry and
+// exit of a function, and times the calls.
+
+namespace core {
+    // Reads a profile written by a program built with -fprofile-generate
+    bool read_profile(llvm_ctx& ctx, const char* pszPath);
+    // Called at the start and end of the body of every function; the end
+    // is after every return has been generated
+    void profile_function_begin(llvm_ctx& ctx, llvm::Function* pFunc);
+    void profile_function_end(llvm_ctx& ctx, llvm::Function* pFunc);
+    // Conditional branch that's counted or weighted by the profile
+    llvm::BranchInst* create_cond_br(llvm_ctx& ctx, llvm::Value* pVCond, llvm::BasicBlock* pBBTrue, llvm::BasicBlock* pBBFalse);
+    // Allocates the counters and registers them with the runtime, or
+    // attaches the summary of the profile to the module
+    void finish_profile(llvm_ctx& ctx);
+}
\ No newline at end of file
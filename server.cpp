@@ -0,0 +1,267 @@
+#include "stdafx.h"
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+namespace core {
+    static volatile sig_atomic_t server_stopping = 0;
+    // The server's own stdout and stderr, while a client's are in their place
+    static int server_out = -1;
+    static int server_err = -1;
+    
+    static void stop_server(int) {
+        server_stopping = 1;
+    }
+    
+    static void redirect_output(int out_fd, int err_fd) {
+        fflush(stdout);
+        fflush(stderr);
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(err_fd, STDERR_FILENO);
+    }
+    
+    static void close_request(server_request& req) {
+        close(req.conn);
+        close(req.out_fd);
+        close(req.err_fd);
+    }
+    
+    include_cache::include_cache() {
+        notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+    
+    include_cache::~include_cache() {
+        if(notify_fd >= 0) {
+            close(notify_fd);
+        }
+    }
+    
+    FILE* include_cache::open(const char* pszPath) {
+        char real[PATH_MAX];
+        if(notify_fd < 0 || !realpath(pszPath, real)) {
+            return fopen(pszPath, "r");
+        }
+        
+        auto it = files.find(real);
+        if(it == files.end()) {
+            // Watched before it's read, so a change made while reading it
+            // isn't missed
+            auto watch = inotify_add_watch(notify_fd, real, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+            if(watch < 0 || watches.count(watch)) {
+                // A hard link to a file that's already cached
+                return fopen(real, "r");
+            }
+            auto f = fopen(real, "r");
+            if(!f) {
+                inotify_rm_watch(notify_fd, watch);
+                return nullptr;
+            }
+            std::string contents;
+            char buf[4096];
+            size_t n;
+            while((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+                contents.append(buf, n);
+            }
+            fclose(f);
+            watches[watch] = real;
+            it = files.emplace(real, std::move(contents)).first;
+        }
+        
+        // fmemopen doesn't take empty buffers everywhere
+        if(it->second.empty()) {
+            return fopen(real, "r");
+        }
+        return fmemopen(&it->second[0], it->second.size(), "r");
+    }
+    
+    void include_cache::invalidate() {
+        alignas(inotify_event) char buf[4096];
+        ssize_t n;
+        while(notify_fd >= 0 && (n = read(notify_fd, buf, sizeof(buf))) > 0) {
+            for(auto p = buf; p < buf + n;) {
+                auto pEvent = (inotify_event*)p;
+                auto it = watches.find(pEvent->wd);
+                if(it != watches.end()) {
+                    files.erase(it->second);
+                    if(!(pEvent->mask & IN_IGNORED)) {
+                        inotify_rm_watch(notify_fd, pEvent->wd);
+                    }
+                    watches.erase(it);
+                }
+                p += sizeof(inotify_event) + pEvent->len;
+            }
+        }
+    }
+    
+    int server_listen(const char* pszSocket) {
+        sockaddr_un addr;
+        if(!make_address(pszSocket, addr)) {
+            return -1;
+        }
+        
+        auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0) {
+            fprintf(stderr, "Couldn't create a socket: %s\n", strerror(errno));
+            return -1;
+        }
+        
+        auto bound = bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+        if(!bound && errno == EADDRINUSE) {
+            // Left behind by a server that's gone, unless one still answers
+            auto probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            auto live = connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0;
+            close(probe);
+            if(!live && unlink(pszSocket) == 0) {
+                bound = bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+            } else {
+                errno = EADDRINUSE;
+            }
+        }
+        if(!bound || listen(fd, 64) < 0) {
+            fprintf(stderr, "Couldn't listen on '%s': %s\n", pszSocket, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        
+        server_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+        server_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+        
+        // Not restarted, so a pending poll returns
+        struct sigaction sa = {};
+        sa.sa_handler = stop_server;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+        // Children are reaped by the kernel
+        signal(SIGCHLD, SIG_IGN);
+        return fd;
+    }
+    
+    // The request is the size of the rest, sent along with the client's
+    // stdout and stderr, then its working directory and arguments, each
+    // terminated by a NUL
+    static bool read_request(int conn, server_request& req) {
+        // A client that stalls doesn't hold up the others for long
+        timeval timeout = {5, 0};
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        
+        uint32_t size;
+        char control[CMSG_SPACE(2 * sizeof(int))];
+        iovec iov = {&size, sizeof(size)};
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) != sizeof(size)) {
+            return false;
+        }
+        
+        auto pCmsg = CMSG_FIRSTHDR(&msg);
+        if(!pCmsg || pCmsg->cmsg_level != SOL_SOCKET || pCmsg->cmsg_type != SCM_RIGHTS) {
+            return false;
+        }
+        int n_fds = (pCmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int fds[2];
+        if(n_fds != 2) {
+            for(int i = 0; i < n_fds && i < 2; i++) {
+                memcpy(&fds[i], CMSG_DATA(pCmsg) + i * sizeof(int), sizeof(int));
+                close(fds[i]);
+            }
+            return false;
+        }
+        memcpy(fds, CMSG_DATA(pCmsg), sizeof(fds));
+        req.out_fd = fds[0];
+        req.err_fd = fds[1];
+        
+        std::string blob(size, 0);
+        if(size == 0 || size > (1 << 20) || !read_all(conn, &blob[0], size) || blob.back() != 0) {
+            close(req.out_fd);
+            close(req.err_fd);
+            return false;
+        }
+        for(size_t i = 0; i < blob.size(); i += strlen(&blob[i]) + 1) {
+            if(req.cwd.empty()) {
+                req.cwd = &blob[i];
+            } else {
+                req.args.push_back(&blob[i]);
+            }
+        }
+        return !req.cwd.empty() && !req.args.empty();
+    }
+    
+    bool server_accept(int listen_fd, include_cache& cache, server_request& req) {
+        while(!server_stopping) {
+            pollfd fds[2] = {
+                {listen_fd, POLLIN, 0},
+                {cache.notify_fd, POLLIN, 0},
+            };
+            if(poll(fds, 2, -1) < 0 || !(fds[0].revents & POLLIN)) {
+                cache.invalidate();
+                continue;
+            }
+            
+            auto conn = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if(conn < 0) {
+                continue;
+            }
+            
+            // Only the user running the server gets to compile with it
+            ucred cred;
+            socklen_t cred_len = sizeof(cred);
+            req = server_request();
+            if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0 || cred.uid != getuid() || !read_request(conn, req)) {
+                close(conn);
+                continue;
+            }
+            req.conn = conn;
+            
+            // Files changed right before the request count
+            cache.invalidate();
+            
+            redirect_output(req.out_fd, req.err_fd);
+            if(chdir(req.cwd.c_str()) < 0) {
+                fprintf(stderr, "Couldn't change to directory '%s': %s\n", req.cwd.c_str(), strerror(errno));
+                server_reply(req, 1);
+                continue;
+            }
+            return true;
+        }
+        return false;
+    }
+    
+    bool server_fork(server_request& req) {
+        fflush(stdout);
+        fflush(stderr);
+        auto pid = fork();
+        if(pid == 0) {
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            return true;
+        }
+        if(pid < 0) {
+            fprintf(stderr, "Couldn't fork: %s\n", strerror(errno));
+            server_reply(req, 1);
+            return false;
+        }
+        redirect_output(server_out, server_err);
+        close_request(req);
+        return false;
+    }
+    
+    void server_reply(server_request& req, int exit_code) {
+        unsigned char code = exit_code;
+        redirect_output(server_out, server_err);
+        write_all(req.conn, &code, 1);
+        close_request(req);
+    }
+}
\ No newline at end of file
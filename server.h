@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/un.h>
+
+// Compile server. `corec --server` listens on a Unix domain socket, and
+// corec-client, which takes the same arguments as corec, forwards its
+// command line, working directory, stdout and stderr to it. The server keeps
+// LLVM initialized and the files #include'd by sources in memory, and forks
+// a child per compile, so compiles run concurrently.
+
+namespace core {
+    // Contents of included files, kept across compiles; an entry is dropped
+    // as soon as inotify reports a change to its file
+    struct include_cache {
+        include_cache();
+        ~include_cache();
+        
+        // Opens an included file, from memory when it's cached
+        FILE* open(const char* pszPath);
+        // Drops the entries of the files changed since the last call
+        void invalidate();
+        
+        // Keyed by the real path of the file
+        std::unordered_map<std::string, std::string> files;
+        std::unordered_map<int, std::string> watches;
+        int notify_fd;
+    };
+    
+    struct server_request {
+        // Connection the exit code is sent back on
+        int conn = -1;
+        // stdout and stderr of the client
+        int out_fd = -1;
+        int err_fd = -1;
+        std::string cwd;
+        std::vector<std::string> args;
+    };
+    
+    // Path of the socket if none is given; under XDG_RUNTIME_DIR, or /tmp
+    std::string default_server_socket();
+    bool make_address(const char* pszSocket, sockaddr_un& addr);
+    bool read_all(int fd, void* pBuf, size_t size);
+    bool write_all(int fd, const void* pBuf, size_t size);
+    
+    // Returns the listening socket, or -1
+    int server_listen(const char* pszSocket);
+    // Waits for the next compile request, invalidating the include cache
+    // meanwhile; false once the server is told to stop
+    bool server_accept(int listen_fd, include_cache& cache, server_request& req);
+    // Returns true in the child, which does the compile and replies; the
+    // server goes on with the next request
+    bool server_fork(server_request& req);
+    // Sends the exit code, and gives the server its own stdout and stderr back
+    void server_reply(server_request& req, int exit_code);
+    // Has a running server compile; false if there's none to connect to
+    bool run_client(const char* pszSocket, int argc, char** argv, int& exit_code);
+}
\ No newline at end of file
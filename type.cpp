@@ -14,9 +14,17 @@ namespace core {
     }
     
     template<>
-        llvm::Type* ranged_type<int>::get_llvm_type(llvm_ctx& ctx) {
+        llvm::Type* ranged_type<float>::get_llvm_type(llvm_ctx& ctx) {
         if(!llvm_type) {
-            llvm_type = llvm::Type::getInt64Ty(ctx.ctx);
+            llvm_type = llvm::Type::getFloatTy(ctx.ctx);
+        }
+        return llvm_type;
+    }
+    
+    template<typename T>
+        llvm::Type* ranged_type<T>::get_llvm_type(llvm_ctx& ctx) {
+        if(!llvm_type) {
+            llvm_type = llvm::Type::getIntNTy(ctx.ctx, 8 * sizeof(T));
         }
         return llvm_type;
     }
@@ -30,8 +38,17 @@ namespace core {
     }
     
     template<> std::string ranged_type<double>::get_type_name() {return "real";}
-    template<> std::string ranged_type<int>::get_type_name() {return "int";}
+    template<> std::string ranged_type<int64_t>::get_type_name() {return "int";}
     template<> std::string ranged_type<bool>::get_type_name() {return "bool";}
+    template<> std::string ranged_type<float>::get_type_name() {return "f32";}
+    template<> std::string ranged_type<int32_t>::get_type_name() {return "i32";}
+    template<> std::string ranged_type<int16_t>::get_type_name() {return "i16";}
+    template<> std::string ranged_type<int8_t>::get_type_name() {return "i8";}
+    
+    template struct ranged_type<int64_t>;
+    template struct ranged_type<int32_t>;
+    template struct ranged_type<int16_t>;
+    template struct ranged_type<int8_t>;
     
     llvm::Type* array_type::get_llvm_type(llvm_ctx& ctx) {
         if(!llvm_type) {
@@ -51,6 +68,17 @@ namespace core {
         return contained->get_type_name() + "[" + std::to_string(max_count) + "]";
     }
     
+    llvm::Type* slice_type::get_llvm_type(llvm_ctx& ctx) {
+        if(!llvm_type) {
+            auto pTyElem = contained->get_llvm_type(ctx);
+            llvm_type = llvm::StructType::get(ctx.ctx, { pTyElem->getPointerTo(), llvm::Type::getInt64Ty(ctx.ctx) });
+        }
+        return llvm_type;
+    }
+    std::string slice_type::get_type_name() {
+        return contained->get_type_name() + "[" + length_name + "]";
+    }
+    
     std::string aggregate_type::get_type_name() {
         std::string ret = name + "<";
         
@@ -77,17 +105,13 @@ namespace core {
     }
     
     type_manager::type_manager() {
-        auto ty_real = std::make_shared<type_real>();
-        auto ty_int = std::make_shared<type_int>();
-        auto ty_bool = std::make_shared<type_bool>();
-        
-        m_types.push_back(ty_real);
-        m_types.push_back(ty_int);
-        m_types.push_back(ty_bool);
-        
-        m_type_map["real"] = ty_real;
-        m_type_map["int"] = ty_int;
-        m_type_map["bool"] = ty_bool;
+        add_type("real", std::make_shared<type_real>());
+        add_type("int", std::make_shared<type_int>());
+        add_type("bool", std::make_shared<type_bool>());
+        add_type("f32", std::make_shared<type_f32>());
+        add_type("i32", std::make_shared<type_i32>());
+        add_type("i16", std::make_shared<type_i16>());
+        add_type("i8", std::make_shared<type_i8>());
     }
     
     // Parses a type atom
@@ -134,13 +158,22 @@ namespace core {
         ret = type_mgr.m_type_map[buf_base_type];
         
         if(pszString[i] == '[') {
-            while(pszString[i] != ']') {
-                if(pszString[i] >= '0' && pszString[i] <= '9') {
+            // The length is either an integer or the name of an int local
+            std::string length_name;
+            i++;
+            while(i < len && pszString[i] != ']') {
+                if(pszString[i] >= '0' && pszString[i] <= '9' && length_name.empty()) {
                     if(array_len == -1) {
                         array_len = 0;
                     }
                     array_len *= 10;
                     array_len += (int)(pszString[i] - '0');
+                } else if(array_len == -1) {
+                    length_name += pszString[i];
+                } else {
+                    log_err(ts, "Invalid array length in type '%s'\n", pszString);
+                    ret = nullptr;
+                    return ret;
                 }
                 i++;
             }
@@ -151,7 +184,11 @@ namespace core {
                     return ret;
                 }
                 
-                ret = std::make_shared<core::array_type>(ret, array_len);
+                if(array_len == -1) {
+                    ret = std::make_shared<core::slice_type>(ret, length_name);
+                } else {
+                    ret = std::make_shared<core::array_type>(ret, array_len);
+                }
             }
         }
         
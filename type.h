@@ -26,8 +26,14 @@ namespace core {
     };
     
     using type_real = ranged_type<double>;
-    using type_int = ranged_type<int>;
+    using type_int = ranged_type<int64_t>;
     using type_bool = ranged_type<bool>;
+    // Narrow types, for arrays where the bandwidth matters more than the
+    // precision; they're only converted to and from explicitly
+    using type_f32 = ranged_type<float>;
+    using type_i32 = ranged_type<int32_t>;
+    using type_i16 = ranged_type<int16_t>;
+    using type_i8 = ranged_type<int8_t>;
     
     struct array_type : public type {
         array_type(sp<type>& contained, int max_count)
@@ -40,6 +46,19 @@ namespace core {
         virtual int count() override { return max_count; }
     };
     
+    // Array with a length only known at runtime; a pointer to the elements
+    // and the number of elements
+    struct slice_type : public type {
+        slice_type(sp<type>& contained, const std::string& length_name)
+            : contained(contained), length_name(length_name) {}
+        sp<type> contained;
+        // Local holding the length of a declared array; empty for parameters
+        std::string length_name;
+        
+        virtual llvm::Type* get_llvm_type(llvm_ctx& ctx) override;
+        virtual std::string get_type_name() override;
+    };
+    
     struct aggregate_type : public type {
         std::string name;
         std::vector<sp<type>> members;
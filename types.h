@@ -4,10 +4,31 @@
 #include <cstdio>
 #include <string>
 #include <memory>
+#include <vector>
 
 #define SHOW_BLOCK_MSG 0
 
 namespace core {
+    // Counts of a function, written by -fprofile-generate and read by
+    // -fprofile-use
+    struct function_profile {
+        uint64_t entry = 0;
+        // Taken and not taken counts of the conditional branches, in the
+        // order they're generated
+        std::vector<std::pair<uint64_t, uint64_t>> branches;
+    };
+    
+    enum class debug_info_level {
+        none,
+        // Just the locations, for the optimization remarks; none of it is
+        // emitted
+        locations,
+        // -gline-tables-only: just enough for line numbers in backtraces
+        line_tables,
+        // -g
+        full,
+    };
+    
     // LLVM State
     struct llvm_ctx {
         llvm::LLVMContext ctx;
@@ -17,23 +38,86 @@ namespace core {
         llvm::DIBuilder dbuilder;
         llvm::DICompileUnit* compile_unit;
         
-        std::unordered_map<std::string, llvm::AllocaInst*> globals;
-        std::unordered_map<std::string, llvm::AllocaInst*> locals;
+        // Module level constants, in .rodata
+        std::unordered_map<std::string, llvm::GlobalVariable*> globals;
+        // Pointers to the storage of the locals; usually allocas, but arrays
+        // shared with a parallel loop body are passed by reference, and the
+        // alloca of an array in the arena holds its address
+        std::unordered_map<std::string, llvm::Value*> locals;
         
         std::unordered_map<llvm::Function*, llvm::DISubroutineType*> di_func_sigs;
         std::unordered_map<std::string, llvm::DIType*> di_types;
         llvm::DIScope* di_scope;
+        // Without debug info, there's no compile unit and no scope
+        debug_info_level debug_info;
         
         bool current_function_pure = false;
+        // Generating the body of a parallel loop, which can't return
+        bool in_parallel_task = false;
+        
+        // Fast math flags of every function; fastmath ones get them all
+        llvm::FastMathFlags fast_math;
+        
+        // Arena mark taken at the entry of the current function, if it
+        // allocates from the arena
+        llvm::Value* arena_mark = nullptr;
+        // Number of arena allocations generated so far
+        size_t arena_allocs = 0;
+        // Loop bodies the code being generated is in, and the depth each
+        // local was declared at; arena memory and mappings of a loop body
+        // are released at the end of every iteration
+        int loop_depth = 0;
+        std::unordered_map<std::string, int> local_depths;
         
         std::unordered_map<llvm::Function*, bool> func_is_pure;
+        // hot and flatten, from any declaration; they have no LLVM
+        // attribute to carry them
+        std::unordered_map<llvm::Function*, unsigned> func_modifiers;
+        
+        // -fprofile-generate: count function entries and branch edges, to
+        // be written to profile_path
+        bool profile_generate = false;
+        std::string profile_path;
+        llvm::GlobalVariable* prof_counters = nullptr;
+        uint64_t prof_n_counters = 0;
+        // Instrumented functions and their first counter
+        std::vector<std::pair<std::string, uint64_t>> prof_functions;
+        // -fprofile-use: the profile of every function
+        std::unordered_map<std::string, function_profile> profile;
+        // Profile of the function being generated and its next branch
+        function_profile* prof_current = nullptr;
+        size_t prof_branch = 0;
+        
+        // -finstrument-functions: time every call of the functions, in
+        // the runtime slot of the current function
+        bool instrument_functions = false;
+        llvm::Value* instr_slot = nullptr;
         
-        llvm_ctx(const char* pszSource, const char* pszModuleName) :
-        builder(ctx), module(pszModuleName, ctx), dbuilder(module), compile_unit(dbuilder.createCompileUnit(llvm::dwarf::DW_LANG_C, dbuilder.createFile(pszSource, "."), "corec", 0, "", 0)), di_scope(nullptr) {
+        llvm_ctx(const char* pszSource, const char* pszModuleName, debug_info_level debug_info = debug_info_level::none) :
+        builder(ctx), module(pszModuleName, ctx), dbuilder(module), compile_unit(nullptr), di_scope(nullptr), debug_info(debug_info) {
+            if(debug_info == debug_info_level::none) {
+                return;
+            }
+            auto kind = llvm::DICompileUnit::NoDebug;
+            if(debug_info == debug_info_level::full) {
+                kind = llvm::DICompileUnit::FullDebug;
+            } else if(debug_info == debug_info_level::line_tables) {
+                kind = llvm::DICompileUnit::LineTablesOnly;
+            }
+            compile_unit = dbuilder.createCompileUnit(llvm::dwarf::DW_LANG_C, dbuilder.createFile(pszSource, "."), "corec", 0, "", 0, llvm::StringRef(), kind);
+            module.addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+            if(debug_info != debug_info_level::full) {
+                return;
+            }
+            
             // Setup debug types
             di_types["real"] = dbuilder.createBasicType("real", 64, llvm::dwarf::DW_ATE_float);
             di_types["int"] = dbuilder.createBasicType("int", 64, llvm::dwarf::DW_ATE_signed);
             di_types["bool"] = dbuilder.createBasicType("bool", 1, llvm::dwarf::DW_ATE_unsigned);
+            di_types["f32"] = dbuilder.createBasicType("f32", 32, llvm::dwarf::DW_ATE_float);
+            di_types["i32"] = dbuilder.createBasicType("i32", 32, llvm::dwarf::DW_ATE_signed);
+            di_types["i16"] = dbuilder.createBasicType("i16", 16, llvm::dwarf::DW_ATE_signed);
+            di_types["i8"] = dbuilder.createBasicType("i8", 8, llvm::dwarf::DW_ATE_signed);
             di_types["_unknown"] = dbuilder.createUnspecifiedType("_unknown");
         }
     };